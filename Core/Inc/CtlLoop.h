@@ -4,13 +4,72 @@
 #include "stm32g4xx_it.h"
 #include "function.h"
 
-void BUCKVLoopCtlPID(void);
+//Incremental PID (2p2z) compensator with clamped integral state
+struct _CMP
+{
+	int32_t		B0;//Q8 coefficients
+	int32_t		B1;
+	int32_t		B2;
+	int32_t		Err1;//e(n-1), Q12
+	int32_t		Err2;//e(n-2), Q12
+	int32_t		Acc;//output accumulator (integral state), Q20
+	int32_t		Min;//output limits, Q12
+	int32_t		Max;
+	uint8_t		Sat;//CMP_SAT_xxx of the last step
+};
+
+#define CMP_SAT_NONE	0
+#define CMP_SAT_HI		1//output held at Max
+#define CMP_SAT_LO		2//output held at Min
+
+#define CTL_LOOP_V		0//voltage loop in control (CV)
+#define CTL_LOOP_I		1//current loop in control (CC)
+#define CTL_LOOP_P		2//power loop in control (CP)
+#define CTL_LOOP_VIN	3//input voltage loop in control (MPPT)
+
+//Fast transient override of the voltage loop (CTR_TRANS)
+struct _TRANS
+{
+	uint8_t		State;//TRANS_xxx
+	uint8_t		Cnt;//cycles left in the override
+	uint8_t		Hold;//cycles before the next override may start
+	uint32_t	Events;//overrides started
+};
+
+#define TRANS_NONE		0
+#define TRANS_UP		1//undershoot, output held at Max
+#define TRANS_DOWN		2//overshoot, output held at Min
 
-extern int32_t  VErr0,VErr1,VErr2;
-extern int32_t	u0,u1;
+#define TRANS_ERR		96//Q12 Vout error that starts an override
+#define TRANS_DERR		24//Q12 error growth per cycle that starts one at half TRANS_ERR
+#define TRANS_EXIT		16//Q12 error at which the linear loop takes over again
+#define TRANS_CYCLES	40//longest override, control cycles
+#define TRANS_HOLDOFF	100//control cycles between overrides
+
+extern struct _CMP VLoop;
+extern struct _CMP ILoop;
+extern struct _CMP PLoop;
+extern struct _CMP VinLoop;
+extern uint8_t CtlActive;
+extern struct _TRANS Trans;
+
+int32_t Cmp_Run(struct _CMP *c, int32_t err);
+void Cmp_Init(struct _CMP *c, int32_t out);
+void Cmp_Track(struct _CMP *c, int32_t out);
+
+void BUCKVLoopCtlPID(void);
+void BUCKVLoopInit(int32_t duty);
+void VinFF(int32_t u);
+int32_t VinFFInv(int32_t duty);
 
 
 //һ 
 #define PERIOD 10240	 
+
+#define VIN_FF_NOM	2048//Q12 Vin the loop coefficients are tuned for
+#define VIN_FF_MIN	400//Q12 Vin floor for the feedforward divide
+//Feedforward acts on the buck leg only, HRTIM_Apply() never drives the
+//boost leg, so in Boost/Mix the loop runs without it
+#define VIN_FF_ON()	((DF.CtrFlag & CTR_FF_EN) && DF.BBFlag == Buck)
 #endif
 
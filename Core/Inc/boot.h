@@ -0,0 +1,38 @@
+#ifndef __BOOT_H
+#define __BOOT_H
+
+#include "main.h"
+
+//Boot phases in the order they complete. Up to BOOT_CTL everything runs
+//before the scheduler starts; the rest is done by Boot_Task().
+typedef enum
+{
+	BOOT_CLOCK,//system clock running, time reference
+	BOOT_HRTIM,//HRTIM configured and DLL calibrated
+	BOOT_ADC,//ADC1 initialised and converting
+	BOOT_CTL,//outputs and control ISR enabled, converter regulating
+	BOOT_COMMS,//USART2 up, command reception armed
+	BOOT_I2C,//I2C3 up
+	BOOT_OLED,//OLED controller initialised and cleared
+	BOOT_DISPLAY,//screen layout painted
+	BOOT_PHASE_NUM
+}BOOT_PHASE;
+
+struct _BOOT_LOG
+{
+	uint32_t	Us[BOOT_PHASE_NUM];//completion time of each phase, uS after BOOT_CLOCK
+	uint16_t	Done;//bit per completed phase
+};
+
+extern struct _BOOT_LOG BootLog;
+
+#define BOOT_READY(phase)	((BootLog.Done & (1u << (phase))) != 0)
+
+#define OLED_PWRUP_MS	200//OLED supply settle time after reset
+#define OLED_ON_MS		100//after the init sequence, before the first write
+
+void Boot_Start(void);
+void Boot_Mark(BOOT_PHASE phase);
+void Boot_Task(void);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __BURST_H
+#define __BURST_H
+
+#include "function.h"
+
+#define BURST_PERIOD_MS	10//Burst_Task period
+#define BURST_I_ENTER	40//Q12 net output current below which burst mode is entered
+#define BURST_I_EXIT	80//Q12 net output current above which it is left
+#define BURST_ENTER_PASSES	20//passes below BURST_I_ENTER before entering, 200mS
+#define BURST_VBAND	12//Q12 Vout band around Voref: idle above +BAND, switch again below -BAND
+#define BURST_IDLE_MAX	200//longest idle slice, switching periods (BMCMPR)
+
+struct _BURST
+{
+	uint8_t		Auto;//automatic entry/exit enabled
+	volatile uint8_t	On;//burst mode engaged, the control ISR gates switching
+	uint8_t		Cnt;//passes below the entry threshold
+	int16_t		IEnter;//entry threshold, Q12 net Iout
+	volatile uint32_t	Cyc;//control cycles while engaged (control ISR)
+	volatile uint32_t	IdleCyc;//of which idle (control ISR)
+	uint16_t	Duty;//switching share of the last pass, permille
+	uint32_t	Entries;//times burst mode was entered
+};
+
+extern struct _BURST Burst;
+
+void Burst_Init(void);
+uint8_t Burst_Isr(void);
+void Burst_Task(void);
+void Burst_Set(uint8_t en, int16_t ienter);
+
+#endif
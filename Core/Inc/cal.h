@@ -0,0 +1,62 @@
+#ifndef __CAL_H
+#define __CAL_H
+
+#include "function.h"
+
+//Channels, in ADC1_RESULT[] order
+#define CAL_VIN		0
+#define CAL_IIN		1
+#define CAL_VOUT	2
+#define CAL_IOUT	3
+#define CAL_CH_NUM	4
+
+#define CAL_PERIOD_MS	10//Cal_Task period
+#define CAL_POINTS_MAX	8//points per channel fit
+#define CAL_AVG_PASSES	32//Cal_Task passes averaged per point
+#define CAL_K_MIN	2048//Q12 accepted gain range of a fit
+#define CAL_K_MAX	8192
+#define CAL_MAGIC	0x4C414343u//"CCAL"
+
+//CMD_CAL operations, Data[0]
+#define CAL_OP_START	0//Data[1]: channel, drops the points taken so far
+#define CAL_OP_POINT	1//Data[1..2]: true value, Q12 little-endian; the ADC is averaged
+#define CAL_OP_FIT		2//least squares gain/offset of the points, applied to RAM
+#define CAL_OP_SAVE		3//write the RAM table to flash
+#define CAL_OP_DEFAULT	4//back to the build time values, RAM only
+
+//CMD_CAL results, reported in the TELE_TYPE_CAL frame
+#define CAL_OK			0
+#define CAL_ERR_ARG		1//bad channel, value or operation
+#define CAL_ERR_BUSY	2//a point is still being averaged
+#define CAL_ERR_FIT		3//fewer than 2 points, or the gain is out of range
+#define CAL_ERR_FLASH	4
+
+//Gain (Q12) and offset (Q12) per channel: value = raw x K >> 12 + B
+struct _CAL
+{
+	int32_t		K[CAL_CH_NUM];
+	int32_t		B[CAL_CH_NUM];
+};
+
+//Calibration session of one channel
+struct _CAL_RUN
+{
+	uint8_t		Ch;//channel being calibrated
+	uint8_t		N;//points taken
+	uint8_t		Busy;//passes left to average, 0 = idle
+	uint8_t		Result;//CAL_OK/CAL_ERR_xxx of the last operation
+	uint8_t		Stored;//the table in use came from flash
+	int32_t		True;//reference value of the point being taken
+	uint32_t	Sum;//raw ADC sum of the point being taken
+	int32_t		X[CAL_POINTS_MAX];//raw ADC averages, x16
+	int32_t		Y[CAL_POINTS_MAX];//reference values, Q12
+};
+
+extern struct _CAL Cal;
+extern struct _CAL_RUN CalRun;
+
+void Cal_Load(void);
+void Cal_Task(void);
+void Cal_Cmd(const uint8_t *data, uint8_t len);
+
+#endif
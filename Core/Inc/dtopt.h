@@ -0,0 +1,44 @@
+#ifndef __DTOPT_H
+#define __DTOPT_H
+
+#include "function.h"
+
+//Dead time modes, CMD_SET_DT
+#define DT_MODE_FIXED	0//common gDeadTime, keys KEY3/KEY4
+#define DT_MODE_LEG		1//per leg gDtLeg[], set by command
+#define DT_MODE_ADAPT	2//per leg gDtLeg[], moved by DtOpt_Task
+
+#define DTOPT_PERIOD_MS	10//DtOpt_Task period
+#define DTOPT_SETTLE	5//passes after a change before measuring
+#define DTOPT_MEASURE	20//passes summed per measurement
+#define DTOPT_BUCKETS	8//load buckets over the Pout range
+#define DTOPT_STEP		8//perturbation, HRTIM ticks (5nS)
+#define DTOPT_PIN_HYST	8//Pin sum drop needed to keep a step
+#define DTOPT_POUT_TOL	(4 * DTOPT_MEASURE)//Pout sum change that voids a measurement
+#define DTOPT_PIN_MIN	64//Q12 input power below which nothing is measured
+
+struct _DTOPT
+{
+	uint8_t		Mode;//DT_MODE_xxx
+	uint8_t		Bkt;//load bucket, 0xFF none
+	uint8_t		Leg;//leg perturbed next, 0 = Timer A, 1 = Timer B
+	uint8_t		Try;//perturbation applied, measuring it
+	uint8_t		Settle;//settling after a change
+	uint8_t		Cnt;//passes in the present settle/measure phase
+	int8_t		Dir[2];//+1/-1 next perturbation per leg
+	int32_t		PinSum;
+	int32_t		PoutSum;
+	int32_t		PinBase;//sums before the perturbation
+	int32_t		PoutBase;
+	int32_t		Old;//gDtLeg[Leg] before the perturbation
+	uint32_t	Steps;//perturbations kept
+	uint32_t	Rejects;//measurements voided by an output change
+	uint16_t	Tab[DTOPT_BUCKETS][2];//dead time per load bucket and leg, 0 unknown
+};
+
+extern struct _DTOPT DtOpt;
+
+void DtOpt_Task(void);
+void DtOpt_Set(uint8_t mode, int32_t dta, int32_t dtb);
+
+#endif
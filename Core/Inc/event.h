@@ -0,0 +1,64 @@
+#ifndef __EVENT_H
+#define __EVENT_H
+
+#include "main.h"
+
+//Single-producer/single-consumer ring queue, no locks.
+//Head is written only by the producer, Tail only by the consumer,
+//both run freely and wrap at 16 bits; depth must be a power of two.
+struct _EVQ
+{
+	volatile uint16_t	Head;//write index (producer)
+	volatile uint16_t	Tail;//read index (consumer)
+	uint16_t	Mask;//depth - 1
+	uint16_t	Size;//element size in bytes
+	volatile uint16_t	HighWater;//highest fill level seen (producer)
+	volatile uint16_t	Drop;//pushes rejected because the queue was full (producer)
+	uint8_t		*Buf;//element storage
+};
+
+//Define a queue of `depth` elements of `type`, depth checked at compile time
+#define EVQ_DEFINE(name, type, depth) \
+	typedef char name##_depth_not_pow2[(((depth) & ((depth) - 1)) == 0 && (depth) <= 32768) ? 1 : -1]; \
+	static type name##_buf[depth]; \
+	struct _EVQ name = {0, 0, (depth) - 1, sizeof(type), 0, 0, (uint8_t *)name##_buf}
+
+uint8_t EvQ_Push(struct _EVQ *q, const void *item);
+uint8_t EvQ_Pop(struct _EVQ *q, void *item);
+uint16_t EvQ_Count(const struct _EVQ *q);
+
+//Event carried by the key, fault and mode queues
+typedef enum
+{
+	EV_NONE,//no event
+	EV_KEY,//key pressed, Arg = key id
+	EV_FAULT,//fault raised, Val = F_SW_xxx bits
+	EV_MODE//mode change request, Arg = MODE_OPEN_LOOP/MODE_CLOSE_LOOP
+}EV_TYPE;
+
+struct _EVENT
+{
+	uint8_t		Type;//EV_TYPE
+	uint8_t		Arg;
+	uint16_t	Val;
+};
+
+//Key ids, in the order of the key table in function.c
+typedef enum
+{
+	KEY_FREQ_INC,
+	KEY_FREQ_DEC,
+	KEY_DT_INC,
+	KEY_DT_DEC,
+	KEY_DUTY_INC,
+	KEY_DUTY_DEC,
+	KEY_MODE,
+	KEY_NUM
+}KEY_ID;
+
+extern struct _EVQ KeyEvQ;//TIM2 ISR -> main loop
+extern struct _EVQ CtlEvQ;//control ISR -> main loop
+extern struct _EVQ CmdQ;//USART2 RX ISR -> main loop
+extern struct _EVQ AppEvQ;//main loop -> main loop (mode changes from commands)
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __EVLOG_H
+#define __EVLOG_H
+
+#include "function.h"
+
+#define LOG_PERIOD_MS	100//Log_Task period
+#define LOG_BATCH		8//records written per Log_Task pass at most
+
+//Record codes
+#define LOG_BOOT	1//Arg: RCC_CSR reset flags >> 24
+#define LOG_FAULT	2//Arg: F_SW_xxx bit
+#define LOG_MODE	3//Arg: MODE_OPEN_LOOP/MODE_CLOSE_LOOP
+#define LOG_CTL_OVR	4//Arg: worst control ISR, CPU cycles (CTL_ISR_BUDGET)
+
+//One record, four double words in flash. Decoded by Tools/evlog.py,
+//keep both in step.
+struct _LOG_REC
+{
+	uint32_t	Seq;//record number, 1.., gives the order in the ring
+	uint32_t	Ms;//uptime, mS
+	uint16_t	Code;//LOG_xxx
+	uint16_t	Arg;
+	uint16_t	ErrFlag;//DF at the event
+	uint16_t	CtrFlag;
+	uint16_t	Vin;//SADC at the event, Q12
+	uint16_t	Iin;
+	uint16_t	Vout;
+	uint16_t	Iout;
+	uint16_t	Duty;//gDuty
+	uint16_t	Perioid;//gPerioid
+	uint8_t		Mode;//currentMode
+	uint8_t		BBFlag;
+	uint16_t	Chk;//low half of the CRC-32 over the bytes before it
+};
+
+struct _LOG
+{
+	uint32_t	Seq;//number of the next record
+	uint16_t	Pos;//next slot in the ring
+	uint16_t	Count;//records that can be read back
+	uint32_t	Written;//records written since boot
+	uint32_t	Failed;//records lost to a flash error
+};
+
+extern struct _LOG Log;
+
+void Log_Init(void);
+void Log_Isr(uint16_t code, uint16_t arg);
+void Log_App(uint16_t code, uint16_t arg);
+void Log_Task(void);
+uint8_t Log_Read(uint16_t back, struct _LOG_REC *dst);
+
+#endif
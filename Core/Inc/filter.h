@@ -0,0 +1,38 @@
+#ifndef __FILTER_H
+#define __FILTER_H
+
+#include "function.h"
+
+//Filter types
+#define FILT_NONE	0//pass through
+#define FILT_IIR1	1//one pole, Acc += x - Acc >> Shift
+#define FILT_IIR2	2//two cascaded IIR1 poles
+#define FILT_BOX	3//moving average of 2^Shift samples
+#define FILT_MED3	4//median of the last 3 samples
+#define FILT_MED5	5//median of the last 5 samples
+
+#define FILT_CH_NUM		4//measurement channels, indexed like CAL_xxx
+#define FILT_SHIFT_MAX	6//IIR time constant up to 64 cycles
+#define FILT_BOX_MAX	4//boxcar of up to 16 samples
+#define FILT_BUF_LEN	(1 << FILT_BOX_MAX)
+#define FILT_REQ_NONE	0xFF
+
+struct _FILT
+{
+	uint8_t		Type;//FILT_xxx
+	uint8_t		Shift;//IIR: pole shift, BOX: log2 of the length
+	uint8_t		Idx;//next slot in Buf
+	volatile uint8_t	Req;//new Type | Shift << 4, taken over by the control ISR
+	int32_t		Acc[2];//IIR pole states, BOX running sum
+	int32_t		Buf[FILT_BUF_LEN];//BOX and median history
+	uint16_t	Cyc;//CPU cycles of the last Filt_Run
+	uint16_t	CycMax;//worst case since the last change
+};
+
+extern struct _FILT Filt[FILT_CH_NUM];
+
+int32_t Filt_Run(struct _FILT *f, int32_t x);
+uint8_t Filt_Set(uint8_t ch, uint8_t type, uint8_t shift);
+uint16_t Filt_Cycles(void);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __FLASH_H
+#define __FLASH_H
+
+#include "main.h"
+
+//Data flash at the top of bank 2 (DBANK = 1, 2KB pages), excluded from
+//IROM in the project settings. Code runs from bank 1, so these pages
+//can be erased and programmed while the CPU keeps fetching.
+#define FLASH_DATA_END	0x08080000u
+#define FLASH_CAL_ADDR	(FLASH_DATA_END - FLASH_PAGE_SIZE)//calibration record, one page
+#define FLASH_PARAM_PAGES	4//parameter log, see params.c
+#define FLASH_PARAM_ADDR	(FLASH_CAL_ADDR - FLASH_PARAM_PAGES * FLASH_PAGE_SIZE)
+#define FLASH_LOG_PAGES	8//event log ring, see evlog.c
+#define FLASH_LOG_ADDR	(FLASH_PARAM_ADDR - FLASH_LOG_PAGES * FLASH_PAGE_SIZE)
+
+//Double ECC errors met in the data pages, counted by the NMI
+struct _FLASH_ECC
+{
+	volatile uint32_t	Cnt;//errors since boot
+	volatile uint32_t	Addr;//double word of the last one
+};
+
+extern struct _FLASH_ECC FlashEcc;
+
+HAL_StatusTypeDef Flash_Erase(uint32_t addr, uint8_t pages);
+HAL_StatusTypeDef Flash_Write(uint32_t addr, const void *src, uint32_t len);
+HAL_StatusTypeDef Flash_Read(void *dst, uint32_t addr, uint32_t len);
+uint8_t Flash_EccNmi(void);
+uint32_t Crc32(const void *src, uint32_t len);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __FREQOPT_H
+#define __FREQOPT_H
+
+#include "function.h"
+
+#define FOPT_PERIOD_MS	10//FreqOpt_Task period
+#define FOPT_SETTLE		5//passes after a frequency change before measuring
+#define FOPT_MEASURE	10//passes averaged per efficiency measurement
+#define FOPT_BUCKETS	8//load buckets over the Pout range
+#define FOPT_STEP		FreqStepPercent//period step of the search, 1%
+#define FOPT_PIN_MIN	64//Q12 input power below which nothing is measured
+#define FOPT_EFF_HYST	4//Q12 efficiency gain needed to accept a step, 0.1%
+
+//Best period found for one load bucket, Per = 0 while unknown
+struct _FOPT_BKT
+{
+	uint16_t	Per;//HRTIM period
+	uint16_t	Eff;//Pout/Pin at that period, Q12
+};
+
+struct _FOPT
+{
+	uint8_t		En;//optimizer enabled
+	uint8_t		Search;//hill climb running in Bkt
+	uint8_t		Bkt;//load bucket of the last measurement, 0xFF none
+	uint8_t		Rev;//search direction already reversed
+	int8_t		Dir;//+1/-1 period step direction
+	uint8_t		Cnt;//passes in the present settle/measure phase
+	uint8_t		Settle;//settling after a period change
+	int32_t		PinSum;
+	int32_t		PoutSum;
+	int32_t		Per;//period being measured
+	int32_t		StartPer;//period the search started from
+	int32_t		BestPer;//best period of the running search
+	uint16_t	Eff;//last measured efficiency, Q12
+	uint16_t	BestEff;
+	uint32_t	Searches;//completed searches
+	struct _FOPT_BKT	Tab[FOPT_BUCKETS];
+};
+
+extern struct _FOPT FreqOpt;
+
+void FreqOpt_Task(void);
+void FreqOpt_Enable(uint8_t en);
+void FreqOpt_Clear(void);
+
+#endif
@@ -6,14 +6,18 @@
 #include "oled.h"
 #include "adc.h"
 
-extern uint16_t ADC1_RESULT[4];
+extern uint16_t ADC1_RESULT[5];//CAL_xxx order, then the potentiometer (SAMP_VADJ)
 extern struct  _ADI SADC;
 extern struct  _Ctr_value  CtrValue;
 extern struct  _FLAG    DF;
+extern struct  _POWER  SPWR;
+extern volatile uint8_t PwrClrReq;
 extern uint16_t OLEDShowCnt;
 
 //
 void ADCSample(void);
+void ADCAverage(void);
+void PowerSample(void);
 void StateM(void);
 void StateMInit(void);
 void StateMWait(void);
@@ -33,14 +37,24 @@ void BBMode(void);
 void OLEDShow(void);
 void MX_OLED_Init(void);
 
-uint8_t Key_Scan(GPIO_TypeDef* GPIOx,uint16_t GPIO_Pin);
+void Key_Sample(void);
 void Button_Task(void);
+void Event_Task(void);
+void Protect_Task(void);
+void SwFault(uint16_t err);
+void SlowFault(uint16_t err);
+void Ctl_Run(void);
+void HRTIM_Apply(void);
+void Freq_Request(int per);
+uint8_t Modulation_Set(uint8_t mod);
+void ShowModeLabel(void);
 HAL_StatusTypeDef Set_HRTIM_CompareValue(uint32_t D1,uint32_t D2,uint32_t T1,uint32_t T2);
+void HRTIM_SetDeadTime(uint8_t leg, uint32_t rise, uint32_t fall);
+HAL_StatusTypeDef Set_HRTIM_LegCompare(uint32_t D1A,uint32_t D1B,uint32_t D2,uint32_t T1,uint32_t T2);
 
 void UpdateDisplay(void); // sWƭ쫬
-void Mode_Switch(void);    // sWƭ쫬
-void Open_Mode_Init(void);
-void Close_Mode_Init(void);
+void Mode_Switch(uint8_t mode);    // sWƭ쫬
+void Display_Layout(uint8_t row);
 void DisplayDutyCycle(float duty_percent);
 void DisplayDeadTime(float dead_time_percent);
 void DisplayFrequency(int frequency);
@@ -51,6 +65,30 @@ extern int gPerioid;	//100KHz
 extern int gHalf;	//50%
 extern int gDeadTime; //2%
 extern int gDuty; //48%
+extern volatile uint8_t currentMode;
+extern volatile uint8_t ModeReq;
+extern uint8_t CtlSat;
+extern uint32_t CtlSatCycles;
+extern volatile int PerReq;
+extern volatile int gDtLeg[2];
+extern volatile uint32_t HrtimErrCnt;
+
+#define MODE_OPEN_LOOP 0
+#define MODE_CLOSE_LOOP 1
+#define MODE_REQ_NONE 0xFF//no transfer pending
+
+//HRTIM period range and key step (the names are historical, these are periods)
+#define FreqMin 11200
+#define FreqMax 20800
+#define FreqStepPercent 160 //1%
+
+#define CLOSE_MAX_DUTY	2048//Q12 closed loop duty limit, 50%
+#define PSFB_MAX_DUTY	3891//Q12 closed loop effective duty limit with CTR_PSFB, 95%
+#define MOD_PWM	0//Modulation_Set()
+#define MOD_PSFB	1
+#define MOD_PCMC	2//peak current mode, see pcmc.c
+#define VREF_STEP	1//Q12 reference slew per control cycle, full scale in ~41ms
+#define DISPLAY_ROWS	4//text rows of the screen layout, 8x16 font
 
 
 /**********************************************/
@@ -72,6 +110,60 @@ extern int gDuty; //48%
 
 #define KEY_ON	1
 #define KEY_OFF	0
+#define KEY_SAMPLE_DIV	100//TIM2 ticks between key samples, 10ms at 10KHz
+
+#define VOUT_OVP_VAL	3900//Q12 output over-voltage threshold
+#define IOUT_OCP_VAL	3900//Q12 output over-current threshold, 2048 = 0A
+#define ILIMIT_DEF	3600//Q12 default CC current limit (CtrValue.ILimit), 2048 = 0A
+#define OVP_CNT	10//control cycles above threshold before tripping
+#define OCP_CNT	10
+#define VIN_UVP_VAL	800//Q12 input under-voltage threshold, armed once Vin was above it
+#define VIN_OVP_VAL	3900//Q12 input over-voltage threshold
+#define VIN_PROT_CNT	5//Protect_Task passes (10ms) beyond threshold before tripping
+
+//DF.CtrFlag bits
+#define CTR_FF_EN	0x0001//Vin feedforward in the voltage loop
+#define CTR_CP_OUT	0x0002//power loop on Vout x Iout (constant power)
+#define CTR_CP_IN	0x0004//power loop on Vin x Iin (input power limit)
+#define CTR_CP_MASK	(CTR_CP_OUT | CTR_CP_IN)
+#define CTR_MPPT_EN	0x0008//input voltage loop on VinRef, moved by mppt.c
+#define CTR_DT_LEG	0x0010//per leg dead time gDtLeg[] instead of gDeadTime
+#define CTR_PSFB	0x0020//phase shifted full bridge, gDuty is the leg B phase
+#define CTR_PCMC	0x0040//peak current mode, the loop output is the COMP1 threshold
+#define CTR_TRANS	0x0080//fast transient override of the voltage loop, see Trans_Run()
+#define CTR_VSET_FIX	0x0100//Voref follows CtrValue.VSet instead of the potentiometer
+
+#define PLIMIT_DEF	2048//Q12 default power limit (CtrValue.PLimit), half of full scale
+#define HRTIM_CLK_HZ	1600000000u//HRTIM counter clock, 100MHz x MUL16
+
+//CtlSat layout, two CMP_SAT_xxx bits per loop
+#define CTL_SAT_V_SHIFT	0//voltage loop
+#define CTL_SAT_I_SHIFT	2//current loop
+#define CTL_SAT_P_SHIFT	4//power loop
+#define CTL_SAT_VIN_SHIFT	6//input voltage loop
+
+#define BB_BUCK_RATIO	3277//Q12 Voref/Vin below which Buck mode is used, 0.8
+#define BB_BOOST_RATIO	4915//Q12 Voref/Vin above which Boost mode is used, 1.2
+#define BB_HYST	82//Q12 hysteresis around both ratios, 2%
+
+#define HRTIM_CMP_MIN	0x60//smallest compare value allowed at PrescalerRatio MUL16
+#define HRTIM_PER_MAX	0xFFDF//largest period allowed at PrescalerRatio MUL16
+#define DT_MIN_TICKS	32//hard minimum per leg dead time, 20nS at 0.625nS per tick
+#define DT_MAX_TICKS	320//largest per leg dead time, 200nS
+#define DT_LEG_DEF	64//per leg dead time until the optimizer has a value, 40nS
+
+//HRTIM dead time units. With HRTIM_HW_DEADTIME set Tx2 is the complement
+//of Tx1 with hardware rising/falling dead time, CMP1 is left free.
+//Dead time ticks: fDTG = 8 x fHRTIM >> HRTIM_DTG_PRSC, 9 bit values.
+#define HRTIM_HW_DEADTIME	0//1: dead time units, 0: compare offsets (gDeadTime/gDtLeg)
+#define HRTIM_FHRTIM_MHZ	100//HRTIM input clock
+#define HRTIM_DTG_PRSC	0//DTPRSC field, 0 = MUL8, 1.25nS per tick at 100MHz
+#define DTG_NS(ns)	((((ns) * ((8 * HRTIM_FHRTIM_MHZ) >> HRTIM_DTG_PRSC)) + 500) / 1000)//nS -> DTG ticks, constant
+#define DTG_TICKS(t)	((t) >> (1 + HRTIM_DTG_PRSC))//HRTIM ticks (MUL16) -> DTG ticks
+#define DTG_MAX	511
+#define DT_RISE_NS	40//default rising edge dead time
+#define DT_FALL_NS	40//default falling edge dead time
+#define DT_HW_MIN_NS	20//hard minimum, same as DT_MIN_TICKS
 
 
 
@@ -90,6 +182,19 @@ struct _ADI
 	int32_t   VadjAvg;//ѹƽֵ
 };
 
+//Power and energy, written by PowerSample() in the control ISR.
+//P = V * (I - 2048) >> 11, so 4096 is full scale voltage times full
+//scale current. Energy is the sum of P times the cycle length in HRTIM
+//ticks; divide by HRTIM_CLK_HZ for Q12 x seconds.
+struct _POWER
+{
+	int32_t		Pin;//input power, Q12
+	int32_t		Pout;//output power, Q12
+	uint64_t	EIn;//input energy, Q12 x HRTIM ticks
+	uint64_t	EOut;//output energy, Q12 x HRTIM ticks
+};
+
+//ADC calibration defaults, used until a per unit table is saved (cal.c)
 #define CAL_VOUT_K	4068//Q12ѹKֵ
 #define CAL_VOUT_B	59//Q12ѹBֵ
 #define CAL_IOUT_K	4096//Q12Kֵ
@@ -109,6 +214,9 @@ struct  _Ctr_value
 	int16_t		BuckDuty;//Buckռձ
 	int16_t		BoostDuty;//Boostռձ
 	int32_t		Ilimitout;//
+	int32_t		PLimit;//power loop reference, Q12, see struct _POWER
+	int32_t		VinRef;//input voltage loop reference, Q12
+	int32_t		VSet;//voltage set point with CTR_VSET_FIX, Q12
 };
 
 //־λ
@@ -0,0 +1,40 @@
+#ifndef __INTERLEAVE_H
+#define __INTERLEAVE_H
+
+#include "function.h"
+
+//Interleaved phases. Phase 0 is the existing Timer A/B stage, phases
+//1..3 run on Timer C, D and F (Tx1 only), reset by master CMP2..CMP4.
+//Timer E is not used, its outputs PC8/PC9 carry I2C3 for the OLED.
+#define INTLV_PHASES	1//populated phases, 1 = interleaving not built
+#define INTLV_PHASES_MAX	4
+
+#define INTLV_PERIOD_MS	10//Intlv_Task period
+#define INTLV_I_PHASE	256//Q12 net output current carried per phase before one more is added
+#define INTLV_I_HYST	64//Q12 hysteresis of phase adding/shedding
+#define INTLV_TRIM_MAX	320//largest duty trim per phase, HRTIM ticks (200nS)
+#define INTLV_TRIM_SHIFT	4//balancing gain, trim += error >> SHIFT per pass
+
+#if INTLV_PHASES > 1
+#define INTLV_UDIS	(HRTIM_CR1_TCUDIS | HRTIM_CR1_TDUDIS | HRTIM_CR1_TFUDIS)//update disable bits of the phase timers
+#else
+#define INTLV_UDIS	0
+#endif
+
+struct _INTLV
+{
+	uint8_t		Active;//phases switching, 1..INTLV_PHASES
+	uint8_t		Shed;//automatic phase shedding enabled
+	volatile int16_t	Trim[INTLV_PHASES_MAX];//duty trim per phase, HRTIM ticks, phase 0 always 0
+	uint16_t	I[INTLV_PHASES_MAX];//phase currents, Q12, 2048 = 0A
+	uint32_t	Changes;//phase count changes
+};
+
+extern struct _INTLV Intlv;
+
+void Intlv_Init(void);
+void Intlv_Apply(int32_t d2, int32_t per);
+void Intlv_Task(void);
+void Intlv_SetShed(uint8_t en);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __IRQPRIO_H
+#define __IRQPRIO_H
+
+#include "stm32g4xx_hal.h"
+
+//NVIC priority plan, NVIC_PRIORITYGROUP_4: 16 preemption levels, no sub-priority.
+//Lower number preempts higher number. The values are checked in irqprio.c,
+//at compile time for the ordering and at boot against the NVIC itself.
+//Keep the NVIC lines of the .ioc file in step with this table.
+#define PRIO_CTL_ISR	0//HRTIM timer A repetition, control tick
+#define PRIO_ADC_ISR	1//ADC1_2
+#define PRIO_ADC_DMA	1//DMA1_Channel1, ADC1 results
+#define PRIO_TICK_ISR	4//TIM2, scheduler tick and key sampling
+#define PRIO_UART_ISR	6//USART2 command reception
+#define PRIO_UART_DMA	6//DMA1_Channel3, USART2 telemetry
+#define PRIO_I2C_DMA	8//DMA1_Channel2, I2C3 OLED
+#define PRIO_SYSTICK	TICK_INT_PRIORITY//HAL time base, lowest
+
+#define PRIO_ERR_GROUP	0x8000//IrqPrioErr bit: priority grouping is not NVIC_PRIORITYGROUP_4
+
+extern uint16_t IrqPrioErr;//bit per IrqPrioTab entry whose NVIC priority differs from the plan
+
+uint16_t IrqPrio_Check(void);
+
+#endif
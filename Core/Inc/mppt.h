@@ -0,0 +1,38 @@
+#ifndef __MPPT_H
+#define __MPPT_H
+
+#include "function.h"
+
+//Tracking algorithms
+#define MPPT_ALG_OFF	0//input voltage loop off, VinRef not moved
+#define MPPT_ALG_PO		1//perturb and observe
+#define MPPT_ALG_INC	2//incremental conductance
+
+#define MPPT_PERIOD_MS	10//Mppt_Task period, one averaged sample per pass
+#define MPPT_STEP_DEF	8//Q12 default VinRef step
+#define MPPT_INTERVAL_DEF	10//default passes per tracking step, 100ms
+#define MPPT_VIN_MIN	(VIN_UVP_VAL + 200)//Q12 VinRef range
+#define MPPT_VIN_MAX	(VIN_OVP_VAL - 100)
+#define MPPT_INC_TOL	64//IncCond dead band on I + V*dI/dV and on dI, Q12 current
+
+struct _MPPT
+{
+	uint8_t		Alg;//MPPT_ALG_xxx
+	uint8_t		Interval;//Mppt_Task passes per tracking step
+	int16_t		Step;//VinRef step, Q12
+	int8_t		Dir;//+1/-1, last move of VinRef
+	uint8_t		Cnt;//passes averaged so far
+	int32_t		VSum;//VinAvg sum over the interval
+	int32_t		ISum;//IinAvg sum over the interval, 0A removed
+	int32_t		VLast;//averages of the previous interval, 0 before the first
+	int32_t		ILast;
+	int32_t		PLast;
+	uint32_t	Steps;//tracking steps taken
+};
+
+extern struct _MPPT Mppt;
+
+void Mppt_Task(void);
+void Mppt_Set(uint8_t alg, int16_t step, uint8_t interval);
+
+#endif
@@ -14,7 +14,9 @@ void WriteCmd(unsigned char I2C_Command);//д
 void WriteDat(unsigned char I2C_Data);//д
 void OLED_Init(void);//ʼ
 void OLED_SetPos(unsigned char x, unsigned char y);
+void OLED_InitSeq(void);//ʼʱ
 void OLED_Fill(unsigned char fill_Data);//ȫ
+void OLED_FillPage(unsigned char page, unsigned char fill_Data);//ҳ
 void OLED_CLS(void);
 void OLED_ON(void);
 void OLED_OFF(void);
@@ -0,0 +1,53 @@
+#ifndef __PARAMS_H
+#define __PARAMS_H
+
+#include "function.h"
+
+#define PARAM_PERIOD_MS	100//Param_Task period
+#define PARAM_SETTLE	50//passes a changed value must stay before it is saved, 5S
+#define PARAM_MAGIC		0x4D524150u//"PARM", page header
+
+//Keys, 1..PARAM_KEY_NUM-1; 0xFFFF is erased flash
+#define PARAM_PERIOD	1//gPerioid
+#define PARAM_DUTY		2//gDuty, open loop
+#define PARAM_DEADTIME	3//gDeadTime, open loop
+#define PARAM_DT_A		4//gDtLeg[0]
+#define PARAM_DT_B		5//gDtLeg[1]
+#define PARAM_ILIMIT	6//CtrValue.ILimit
+#define PARAM_PLIMIT	7//CtrValue.PLimit
+#define PARAM_CTRFLAG	8//DF.CtrFlag & PARAM_FLAG_MASK
+#define PARAM_VSET		9//CtrValue.VSet, saved while CTR_VSET_FIX
+#define PARAM_KEY_NUM	10
+
+//CtrFlag options that are kept; modulation and MPPT are chosen at run time
+#define PARAM_FLAG_MASK	(CTR_FF_EN | CTR_CP_MASK | CTR_DT_LEG | CTR_TRANS | CTR_VSET_FIX)
+
+//CMD_PARAM operations, Data[0]
+#define PARAM_OP_SAVE	0//save changed values now, without waiting PARAM_SETTLE
+#define PARAM_OP_ERASE	1//erase the store, build time values from the next boot
+
+//RAM index of the newest stored value of every key
+struct _PARAM
+{
+	uint32_t	Value[PARAM_KEY_NUM];
+	uint16_t	Valid;//bit per key: a value is stored
+	uint16_t	Dirty;//bit per key: Value not yet in flash
+	uint8_t		Page;//active page, 0..FLASH_PARAM_PAGES-1
+	uint8_t		Ok;//a page with a valid header exists
+	uint8_t		Now;//save changes on the next pass without settling
+	uint8_t		Off;//store erased, nothing saved until the next boot
+	uint16_t	Next;//next free entry in the active page
+	uint32_t	Seq;//generation of the active page
+	uint32_t	Writes;//entries programmed
+	uint32_t	Erases;//pages erased
+	uint32_t	Cand[PARAM_KEY_NUM];//changed live value waiting to settle
+	uint8_t		Cnt[PARAM_KEY_NUM];//passes Cand has been stable
+};
+
+extern struct _PARAM Param;
+
+void Param_Load(void);
+void Param_Task(void);
+void Param_Cmd(const uint8_t *data, uint8_t len);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __PCMC_H
+#define __PCMC_H
+
+#include "function.h"
+
+//Peak current mode: Iout sense on PB1 (COMP1_INP), threshold from the
+//DAC3 channel 1 sawtooth (COMP1_INM), COMP1 ends the on time of leg A
+//through HRTIM external event 4 in fast (asynchronous) mode.
+#define PCMC_STEPS	32//sawtooth steps per switching period (Timer E CMP2 interval)
+#define PCMC_SLOPE	256//Q12 slope compensation, DAC decrease over one period
+#define PCMC_REF_MIN	2048//Q12 threshold at zero loop output, the Iout offset
+#define PCMC_REF_MAX	4000//Q12 highest threshold, cycle by cycle current limit
+
+//DAC3 sawtooth trigger selections (RM0440 DAC trigger table, STMODR):
+//hrtim_dac_reset_trg5 / hrtim_dac_step_trg5 come from Timer E
+#define PCMC_DAC_RST_TRG	14
+#define PCMC_DAC_STEP_TRG	14
+
+void Pcmc_Init(void);
+void Pcmc_Enable(uint8_t on);
+void Pcmc_SetRef(int32_t u);
+
+#endif
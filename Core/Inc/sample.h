@@ -0,0 +1,80 @@
+#ifndef __SAMPLE_H
+#define __SAMPLE_H
+
+#include "cal.h"
+
+/* ---- Board configuration ------------------------------------------------
+** Which ADC1 inputs are wired on the board. SAMP_BOARD_DP is the board
+** this project is built for: ADC1 sees only the set point potentiometer
+** on PA0 (ADC1_IN1), there is no Vin/Iin/Vout/Iout divider. A power stage
+** with sense dividers builds with SAMP_BOARD_DP=0 and names its channels
+** in the #else branch; a missing channel is a build error. The current
+** sense for peak current mode goes to COMP1 on PB1 (pcmc.h), not to an
+** ADC channel, and is wired on the power stage only.
+** ------------------------------------------------------------------------*/
+#ifndef SAMP_BOARD_DP
+#define SAMP_BOARD_DP	1
+#endif
+
+#if SAMP_BOARD_DP
+#define SAMP_HAS_VIN	0
+#define SAMP_HAS_IIN	0
+#define SAMP_HAS_VOUT	0
+#define SAMP_HAS_IOUT	0
+#define SAMP_HAS_ISENSE	0
+#else
+#define SAMP_HAS_VIN	1
+#define SAMP_HAS_IIN	1
+#define SAMP_HAS_VOUT	1
+#define SAMP_HAS_IOUT	1
+#define SAMP_HAS_ISENSE	1
+//#define SAMP_CH_VIN	ADC_CHANNEL_x//regular, oversampled
+//#define SAMP_CH_IIN	ADC_CHANNEL_x//regular, oversampled
+//#define SAMP_CH_VOUT	ADC_CHANNEL_x//injected, HRTIM triggered
+//#define SAMP_CH_IOUT	ADC_CHANNEL_x//injected, HRTIM triggered
+#endif
+
+#if SAMP_HAS_VIN && !defined(SAMP_CH_VIN)
+#error "sample.h: SAMP_CH_VIN, ADC1 channel of the Vin divider, not set"
+#endif
+#if SAMP_HAS_IIN && !defined(SAMP_CH_IIN)
+#error "sample.h: SAMP_CH_IIN, ADC1 channel of the Iin sense, not set"
+#endif
+#if SAMP_HAS_VOUT && !defined(SAMP_CH_VOUT)
+#error "sample.h: SAMP_CH_VOUT, ADC1 channel of the Vout divider, not set"
+#endif
+#if SAMP_HAS_IOUT && !defined(SAMP_CH_IOUT)
+#error "sample.h: SAMP_CH_IOUT, ADC1 channel of the Iout sense, not set"
+#endif
+/* ---- End of board configuration ---------------------------------------*/
+
+//CtrFlag options that act on a sense the board lacks and are refused:
+//the Vin feedforward, MPPT (Vin and Iin), the input power limit and
+//peak current mode (PB1 current sense)
+#define SAMP_FLAGS_NA	((SAMP_HAS_VIN ? 0 : CTR_FF_EN) \
+						| ((SAMP_HAS_VIN && SAMP_HAS_IIN) ? 0 : (CTR_MPPT_EN | CTR_CP_IN)) \
+						| (SAMP_HAS_ISENSE ? 0 : CTR_PCMC))
+
+#define SAMP_CH_VADJ	ADC_CHANNEL_1//PA0, set point potentiometer, every board
+#define SAMP_VADJ		CAL_CH_NUM//ADC1_RESULT[] slot of the potentiometer, after the CAL_xxx ones
+
+#define SAMP_REG_NUM	(1 + SAMP_HAS_VIN + SAMP_HAS_IIN)//regular ranks: Vadj, Vin, Iin
+#define SAMP_INJ_NUM	(SAMP_HAS_VOUT + SAMP_HAS_IOUT)//injected ranks: Vout, Iout
+
+//Regular group: 16 x oversampling, shifted back to 12 bits so the
+//calibration and all Q12 values keep their scale
+#define SAMP_OVS_RATIO	ADC_OVERSAMPLING_RATIO_16
+#define SAMP_OVS_SHIFT	ADC_RIGHTBITSHIFT_4
+
+//Injected group: started by HRTIM ADC trigger 2 on Timer A CMP4,
+//SAMP_LEAD_NS before the period end, so both conversions (2 x 25 ADC
+//clocks at 50MHz) are done when the REP interrupt reads them
+#define SAMP_LEAD_NS	1500
+#define SAMP_LEAD_TICKS	(SAMP_LEAD_NS * (HRTIM_CLK_HZ / 1000000u) / 1000u)
+
+void Samp_Init(void);
+void Samp_Start(void);
+void Samp_Read(void);
+void Samp_Apply(int32_t per);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#include "main.h"
+
+//Scheduler time base: TIM2 update interrupt every 100uS
+#define SCHED_TICK_US	100
+#define SCHED_MS(ms)	((uint16_t)((ms) * 1000 / SCHED_TICK_US))
+
+//Cooperative task, released by the TIM2 tick and run in the main loop
+struct _TASK
+{
+	void		(*Func)(void);//task body
+	uint16_t	Period;//release period, ticks
+	uint16_t	Phase;//first release offset, ticks
+	uint16_t	Cnt;//ticks to next release (TIM2 ISR)
+	volatile uint16_t	Release;//release counter (TIM2 ISR)
+	uint16_t	Done;//releases served (main loop)
+	uint16_t	Overrun;//releases lost because the task was still pending
+	uint32_t	RunCnt;//number of executions
+	uint32_t	ExecLast;//last execution time, CPU cycles
+	uint32_t	ExecMax;//worst execution time, CPU cycles
+};
+
+//CPU load over the last LOAD_WINDOW_MS, permille of all cycles
+#define LOAD_WINDOW_MS	100
+struct _LOAD
+{
+	uint16_t	Cpu;//everything but idle
+	uint16_t	CtlIsr;//control ISR (HRTIM timer A)
+	uint16_t	TickIsr;//scheduler tick ISR (TIM2)
+	uint16_t	Task;//main loop tasks and the remaining interrupts
+	uint16_t	Idle;//sleeping in WFI
+	uint16_t	Over;//control ISR runs over CTL_ISR_BUDGET in the window
+};
+
+extern struct _TASK TaskTab[];
+extern const uint8_t TaskNum;
+extern volatile uint32_t SchedTick;
+extern struct _LOAD CpuLoad;
+extern volatile uint32_t CtlIsrCyc;//free running cycle sums, written by the ISRs
+extern volatile uint32_t TickIsrCyc;
+extern volatile uint32_t CtlIsrMax;//worst control ISR, CPU cycles
+extern volatile uint32_t CtlIsrOver;//control ISR runs over CTL_ISR_BUDGET
+
+//Control ISR budget: 60% of the shortest switching period, FreqMin/16 =
+//700 CPU cycles at 100MHz (HRTIM at 16 x HCLK), the rest is left to the
+//tick ISR and the tasks. Overruns are counted and logged (LOG_CTL_OVR).
+#define CTL_ISR_BUDGET	420
+//Housekeeping (snapshot, Vin/Iin/Iout/Vadj averages) every CTL_HK_DIV
+//control ticks, 12.5kHz at 100kHz switching
+#define CTL_HK_DIV		8
+
+void Sched_Init(void);
+void Sched_Tick(void);
+void Sched_Run(void);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include "function.h"
+
+//Snapshot of one control cycle, published by the control ISR
+struct _SNAP
+{
+	uint32_t	Tick;//control cycle counter
+	struct _ADI	Adc;//sampled values
+	struct _Ctr_value	Ctr;//control values
+	struct _FLAG	Flag;//flag bits
+	int32_t		Perioid;//HRTIM period
+	int32_t		Duty;//TA2/TB2 duty
+	int32_t		DeadTime;//TA1/TB1 dead time
+	uint8_t		Mode;//open/close loop
+	uint8_t		Sat;//CtlSat, loop saturation bits
+	uint8_t		Active;//CtlActive, CTL_LOOP_xxx
+	uint32_t	SatCycles;//CtlSatCycles
+	struct _POWER	Pwr;//power and energy
+};
+
+//Seqlock: Seq is odd while the writer is updating Data
+struct _SEQ_SNAP
+{
+	volatile uint32_t	Seq;
+	struct _SNAP		Data;
+};
+
+extern struct _SEQ_SNAP TeleSnap;
+extern volatile uint32_t TeleRetryCnt;
+
+//Command frame received over USART2, same framing as telemetry
+#define CMD_DATA_MAX	16
+struct _CMD_FRAME
+{
+	uint8_t		Cmd;//command code
+	uint8_t		Len;//number of valid bytes in Data
+	uint8_t		Data[CMD_DATA_MAX];
+};
+
+void Tele_Publish(void);
+void Tele_Read(struct _SNAP *dst);
+void Tele_Task(void);
+void Tele_BootReport(void);
+void Tele_CalReport(void);
+void Tele_LogReport(uint16_t back, uint16_t num);
+void Tele_RxStart(void);
+void Cmd_Process(const struct _CMD_FRAME *frame);
+
+//UART telemetry frame: head(2) + type(1) + len(1) + payload + sum(1)
+#define TELE_HEAD1		0xA5
+#define TELE_HEAD2		0x5A
+#define TELE_TYPE_STATUS	0x01
+#define TELE_TYPE_BOOT	0x02//boot log: Done(2) + BOOT_PHASE_NUM x uS(4)
+#define TELE_TYPE_CAL	0x03//calibration: Result, Ch, N, Stored + CAL_CH_NUM x (K(2), B(2))
+#define TELE_TYPE_LOG	0x04//event log: Count(2), Back(2), N(1) + N x struct _LOG_REC, newest first
+#define TELE_LOG_RECS	2//records per TELE_TYPE_LOG frame
+#define TELE_BUF_SIZE	96
+#define TELE_PERIOD_MS	100//status frame every 100ms
+
+//Command codes (host -> board)
+#define CMD_GET_STATUS	0x10//send a status frame now
+#define CMD_SET_MODE	0x11//Data[0]: MODE_OPEN_LOOP/MODE_CLOSE_LOOP
+#define CMD_GET_BOOT	0x12//send the boot log
+#define CMD_SET_FF		0x13//Data[0]: 1 enables Vin feedforward (not without a Vin sense, see sample.h), 0 disables it
+#define CMD_SET_ILIMIT	0x14//Data[0..1]: CC current limit, Q12 little-endian, 2048 = 0A
+#define CMD_SET_PLIMIT	0x15//Data[0..1]: power limit, Q12 little-endian; Data[2]: CP_SEL_xxx
+#define CMD_CLR_ENERGY	0x16//clear the energy counters
+#define CMD_SET_MPPT	0x17//Data[0]: MPPT_ALG_xxx; Data[1..2]: step, Q12 little-endian; Data[3]: interval, 10ms passes (0 keeps the present value)
+#define CMD_SET_FOPT	0x18//Data[0]: 0 off, 1 on, 2 clear the stored periods and on
+#define CMD_SET_DT		0x19//Data[0]: DT_MODE_xxx; DT_MODE_LEG: Data[1..2] leg A, Data[3..4] leg B, HRTIM ticks little-endian
+#define CMD_SET_MOD		0x1A//Data[0]: MOD_PWM/MOD_PSFB/MOD_PCMC, open loop only, MOD_PCMC needs SAMP_HAS_ISENSE
+#define CMD_SET_INTLV	0x1B//Data[0]: 1 enables phase shedding, 0 runs all interleaved phases
+#define CMD_SET_BURST	0x1C//Data[0]: 1 automatic burst mode, 0 off; Data[1..2]: entry current, Q12 little-endian (0 keeps the present value)
+#define CMD_SET_TRANS	0x1D//Data[0]: 1 enables the fast transient override, 0 disables it
+#define CMD_CAL		0x1E//Data[0]: CAL_OP_xxx, see cal.h; answered with a TELE_TYPE_CAL frame
+#define CMD_PARAM		0x1F//Data[0]: PARAM_OP_xxx, see params.h
+#define CMD_GET_LOG	0x20//Data[0..1]: first record back from the newest, Data[2..3]: number of records, little-endian (0 = all)
+#define CMD_SET_FILT	0x21//Data[0]: CAL_xxx channel, 0xFF all; Data[1]: FILT_xxx; Data[2]: shift, see filter.h
+#define CMD_SET_VREF	0x22//Data[0..1]: voltage set point, Q12 little-endian; 0xFFFF back to the potentiometer
+
+//CMD_SET_PLIMIT power loop selection
+#define CP_SEL_OFF	0
+#define CP_SEL_OUT	1//regulate Vout x Iout
+#define CP_SEL_IN	2//limit Vin x Iin
+
+#endif
@@ -25,57 +25,373 @@
 /* USER CODE END Header */
 #include "CtlLoop.h"
 
+//·Ĳmathcadļbuck-ѹ-PIDͲ
+#define BUCKPIDb0	5203		//Q8
+#define BUCKPIDb1	-10246	//Q8
+#define BUCKPIDb2	5044		//Q8
+//Current loop PI, b0 = Kp + Ki, b1 = -Kp; starting values, tune on the load
+#define BUCKIPIb0	320		//Q8
+#define BUCKIPIb1	-288	//Q8
+#define BUCKIPIb2	0		//Q8
+//Power loop PI, same form; starting values, tune with the source
+#define BUCKPPIb0	256		//Q8
+#define BUCKPPIb1	-232	//Q8
+#define BUCKPPIb2	0		//Q8
+//Input voltage loop PI (MPPT), same form; starting values, tune with the source
+#define BUCKNPIb0	384		//Q8
+#define BUCKNPIb1	-352	//Q8
+#define BUCKNPIb2	0		//Q8
+
 /****************·**********************/
-int32_t   VErr0=0,VErr1=0,VErr2=0;//ѹQ12
-int32_t		u0=0,u1=0,u2=0;//ѹ
+struct _CMP VLoop = {BUCKPIDb0, BUCKPIDb1, BUCKPIDb2, 0, 0, 0, MIN_BUKC_DUTY, MIN_BUKC_DUTY, CMP_SAT_NONE};//ѹ
+struct _CMP ILoop = {BUCKIPIb0, BUCKIPIb1, BUCKIPIb2, 0, 0, 0, MIN_BUKC_DUTY, MIN_BUKC_DUTY, CMP_SAT_NONE};//
+struct _CMP PLoop = {BUCKPPIb0, BUCKPPIb1, BUCKPPIb2, 0, 0, 0, MIN_BUKC_DUTY, MIN_BUKC_DUTY, CMP_SAT_NONE};//power loop
+struct _CMP VinLoop = {BUCKNPIb0, BUCKNPIb1, BUCKNPIb2, 0, 0, 0, MIN_BUKC_DUTY, MIN_BUKC_DUTY, CMP_SAT_NONE};//input voltage loop
+uint8_t CtlActive = CTL_LOOP_V;//loop that set the duty in the last cycle
+struct _TRANS Trans = {TRANS_NONE, 0, 0, 0};//fast transient override
+
+/*
+** ===================================================================
+**     Funtion Name :  int32_t Cmp_Run(struct _CMP *c, int32_t err)
+**     Description :   Incremental PID (2p2z) step with anti-windup
+**       u(n) = u(n-1) + b0*e(n) + b1*e(n-1) + b2*e(n-2)
+**       The accumulator u is the integral state. It is clamped to
+**       [Min, Max] before it is stored, so during saturation it never
+**       runs past the limit and the loop leaves saturation on the first
+**       cycle the error changes sign. Sat reports the clamp.
+**     Parameters  :c - compensator, err - reference minus feedback, Q12
+**     Returns     :output, Q12
+** ===================================================================
+*/
+CCMRAM int32_t Cmp_Run(struct _CMP *c, int32_t err)
+{
+	int32_t acc = c->Acc + err * c->B0 + c->Err1 * c->B1 + c->Err2 * c->B2;
+
+	c->Err2 = c->Err1;
+	c->Err1 = err;
+
+	c->Sat = CMP_SAT_NONE;
+	if(acc > (c->Max << 8))
+	{
+		acc = c->Max << 8;
+		c->Sat = CMP_SAT_HI;
+	}
+	else if(acc < (c->Min << 8))
+	{
+		acc = c->Min << 8;
+		c->Sat = CMP_SAT_LO;
+	}
+	c->Acc = acc;
+	return acc >> 8;
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  void Cmp_Init(struct _CMP *c, int32_t out)
+**     Description :   Preload for a bumpless start
+**       Loading the integral state with the output that is already
+**       applied makes the first output equal to it; the error history
+**       is cleared.
+**     Parameters  :c - compensator, out - present output, Q12
+**     Returns     :
+** ===================================================================
+*/
+CCMRAM void Cmp_Init(struct _CMP *c, int32_t out)
+{
+	if(out > c->Max)
+		out = c->Max;
+	if(out < c->Min)
+		out = c->Min;
+	c->Err1 = 0;
+	c->Err2 = 0;
+	c->Acc = out << 8;
+	c->Sat = CMP_SAT_NONE;
+}
+
 /*
 ** ===================================================================
-**     Funtion Name :  void BUCKVLoopCtlPI(void)
-**     Description :   λʽPIѹ··
+**     Funtion Name :  void Cmp_Track(struct _CMP *c, int32_t out)
+**     Description :   Make an inactive compensator follow the output
+**       that is actually applied. Only the integral state is moved,
+**       the error history stays, so the loop resumes without a step
+**       when it is selected again.
+**     Parameters  :c - compensator, out - applied output, Q12
+**     Returns     :
+** ===================================================================
+*/
+CCMRAM void Cmp_Track(struct _CMP *c, int32_t out)
+{
+	c->Acc = out << 8;
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  void BUCKVLoopLimit(void)
+**     Description :   Output limits of the voltage loop, in the units
+**                     of its output (normalised duty with feedforward)
 **     Parameters  :
 **     Returns     :
 ** ===================================================================
 */
+static CCMRAM void BUCKVLoopLimit(void)
+{
+	if(!VIN_FF_ON())
+	{
+		VLoop.Max = CtrValue.BUCKMaxDuty;
+		VLoop.Min = MIN_BUKC_DUTY;
+	}
+	else
+	{
+		VLoop.Max = VinFFInv(CtrValue.BUCKMaxDuty);
+		VLoop.Min = VinFFInv(MIN_BUKC_DUTY);
+	}
+	ILoop.Max = VLoop.Max;
+	ILoop.Min = VLoop.Min;
+	PLoop.Max = VLoop.Max;
+	PLoop.Min = VLoop.Min;
+	VinLoop.Max = VLoop.Max;
+	VinLoop.Min = VLoop.Min;
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  int32_t Trans_Run(int32_t err, int32_t u)
+**     Description :   Fast transient override of the voltage loop
+**       A large load step shows up as a Vout error beyond TRANS_ERR, or
+**       beyond half of it while still growing by TRANS_DERR per cycle.
+**       The output is then held at Max (undershoot) or Min (overshoot)
+**       until the error is back within TRANS_EXIT, at most TRANS_CYCLES.
+**       The voltage loop tracks the held output, so the linear loop
+**       takes over from it without a step. TRANS_HOLDOFF cycles pass
+**       before the next override, the loop settles in between.
+**       No override starts, and a running one ends, while another loop
+**       was in control in the last cycle: the error is then a limit
+**       holding Vout down, and pushing the voltage loop to Max against
+**       it rings the current loop (seen in Tools/host/ctl_test.c).
+**     Parameters  :err - voltage loop error, u - voltage loop output
+**     Returns     :output to use for the voltage loop, Q12
+** ===================================================================
+*/
+static CCMRAM int32_t Trans_Run(int32_t err, int32_t u)
+{
+	int32_t derr = err - VLoop.Err2;//Cmp_Run() has moved e(n-1) there
+
+	if(Trans.State == TRANS_NONE)
+	{
+		if(Trans.Hold)
+		{
+			Trans.Hold--;
+			return u;
+		}
+		if(CtlActive != CTL_LOOP_V)
+			return u;//a limit loop holds Vout down on purpose
+		if(err > TRANS_ERR || (err > TRANS_ERR / 2 && derr > TRANS_DERR))
+			Trans.State = TRANS_UP;
+		else if(err < -TRANS_ERR || (err < -TRANS_ERR / 2 && derr < -TRANS_DERR))
+			Trans.State = TRANS_DOWN;
+		else
+			return u;
+		Trans.Cnt = TRANS_CYCLES;
+		Trans.Events++;
+	}
+	else if(--Trans.Cnt == 0 || CtlActive != CTL_LOOP_V
+		|| (Trans.State == TRANS_UP && err < TRANS_EXIT)
+		|| (Trans.State == TRANS_DOWN && err > -TRANS_EXIT))
+	{
+		Trans.State = TRANS_NONE;
+		Trans.Hold = TRANS_HOLDOFF;
+		return u;//the accumulator holds the last override output
+	}
+
+	u = (Trans.State == TRANS_UP) ? VLoop.Max : VLoop.Min;
+	Cmp_Track(&VLoop, u);
+	return u;
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  int32_t BUCKLoopSelect(void)
+**     Description :   CV/CC/CP operation
+**       The voltage loop (Voref) and the current loop (ILimit) both
+**       run every cycle and the lowest output is used. The other loops
+**       track the applied output, so they cannot wind up while inactive
+**       and take over within a few cycles once their own error asks for
+**       less duty: CV -> CC when Iout reaches ILimit, CC -> CV when the
+**       load lets Vout reach Voref.
+**       With CTR_CP_OUT or CTR_CP_IN set the power loop joins the
+**       selection with PLimit against Pout or Pin. Pout regulation gives
+**       constant power below Voref/ILimit; Pin keeps a power limited
+**       source out of collapse. While off it is preloaded every cycle,
+**       so it starts bumplessly when switched on.
+**       With CTR_MPPT_EN set the input voltage loop joins the same way:
+**       its error is Vin - VinRef, so it takes duty away when the
+**       source sags below the reference set by the MPP tracker.
+**       With CTR_TRANS set the voltage loop output passes through
+**       Trans_Run() before the selection, so the current and power
+**       limits still apply during a transient override.
+**     Parameters  :
+**     Returns     :selected output, Q12
+** ===================================================================
+*/
+static CCMRAM int32_t BUCKLoopSelect(void)
+{
+	int32_t u, ui, up, un;
+
+	u = Cmp_Run(&VLoop, CtrValue.Voref - SADC.Vout);
+	if(DF.CtrFlag & CTR_TRANS)
+		u = Trans_Run(CtrValue.Voref - SADC.Vout, u);
+	else
+		Trans.State = TRANS_NONE;
+	CtlActive = CTL_LOOP_V;
+
+	ui = Cmp_Run(&ILoop, CtrValue.ILimit - SADC.Iout);
+	CtrValue.Ilimitout = ui;
+	if(ui < u)
+	{
+		u = ui;
+		CtlActive = CTL_LOOP_I;
+	}
+
+	if(DF.CtrFlag & CTR_CP_MASK)
+	{
+		up = Cmp_Run(&PLoop, CtrValue.PLimit - ((DF.CtrFlag & CTR_CP_IN) ? SPWR.Pin : SPWR.Pout));
+		if(up < u)
+		{
+			u = up;
+			CtlActive = CTL_LOOP_P;
+		}
+	}
+
+	if(DF.CtrFlag & CTR_MPPT_EN)
+	{
+		un = Cmp_Run(&VinLoop, SADC.Vin - CtrValue.VinRef);
+		if(un < u)
+		{
+			u = un;
+			CtlActive = CTL_LOOP_VIN;
+		}
+	}
+
+	if(CtlActive != CTL_LOOP_V)
+		Cmp_Track(&VLoop, u);
+	if(CtlActive != CTL_LOOP_I)
+		Cmp_Track(&ILoop, u);
+	if((DF.CtrFlag & CTR_CP_MASK) == 0)
+		Cmp_Init(&PLoop, u);
+	else if(CtlActive != CTL_LOOP_P)
+		Cmp_Track(&PLoop, u);
+	if((DF.CtrFlag & CTR_MPPT_EN) == 0)
+		Cmp_Init(&VinLoop, u);
+	else if(CtlActive != CTL_LOOP_VIN)
+		Cmp_Track(&VinLoop, u);
+	return u;
+}
+
 /*
 ** ===================================================================
 **     Funtion Name :  void BUCKVLoopCtlPID(void)
 **     Description :   ѹ··-PIDѹ·-PID·ĵ
+**                     CV/CC/CP: the current and power loops run alongside,
+**                     see BUCKLoopSelect()
 **     Parameters  :
 **     Returns     :
 ** ===================================================================
 */
-//·Ĳmathcadļbuck-ѹ-PIDͲ
-#define BUCKPIDb0	5203		//Q8
-#define BUCKPIDb1	-10246	//Q8
-#define BUCKPIDb2	5044		//Q8
 CCMRAM void BUCKVLoopCtlPID(void)
 {
-	int32_t VoutTemp=0;//ѹ
-	
-	//ѹ
-	VoutTemp = ((uint32_t )ADC1_RESULT[2]*CAL_VOUT_K>>12)+CAL_VOUT_B;
+	int32_t u;
+
+	BUCKVLoopLimit();
 	//ѹοѹѹռձӣ
-	VErr0= CtrValue.Voref  - VoutTemp;
-	//PID·㹫ʽPID·ĵ
-	u0 = u1 + VErr0*BUCKPIDb0 + VErr1*BUCKPIDb1 + VErr2*BUCKPIDb2;	
-	//ʷݷֵ
-	VErr2 = VErr1;
-	VErr1 = VErr0;
-	u1 = u0;
-	//·ֵu08λΪBUCKPIDb0-2ΪΪŴQ8
-	CtrValue.BuckDuty= u0>>8;
-	CtrValue.BoostDuty=MIN_BOOST_DUTY1;//BOOSTϹ̶ܹռձ93%¹7%			
+	//Vout/Iout are already calibrated by ADCSample() in the same control tick
+	u = BUCKLoopSelect();
+
+	if(VIN_FF_ON())
+		VinFF(u);
+	else
+	{
+		CtrValue.BuckDuty= u;
+		CtrValue.BoostDuty=MIN_BOOST_DUTY1;//BOOSTϹ̶ܹռձ93%¹7%			
+	}
 	//·Сռձ
 	if(CtrValue.BuckDuty > CtrValue.BUCKMaxDuty)
 		CtrValue.BuckDuty = CtrValue.BUCKMaxDuty;	
 	if(CtrValue.BuckDuty < MIN_BUKC_DUTY)
 		CtrValue.BuckDuty = MIN_BUKC_DUTY;
+	if(CtrValue.BoostDuty > MAX_BOOST_DUTY1)
+		CtrValue.BoostDuty = MAX_BOOST_DUTY1;
+	if(CtrValue.BoostDuty < MIN_BOOST_DUTY)
+		CtrValue.BoostDuty = MIN_BOOST_DUTY;
 	//PWMENFlagPWM־λλΪ0ʱ,buckռձΪ0;
 	if(DF.PWMENFlag==0)
 		CtrValue.BuckDuty = MIN_BUKC_DUTY;
-	//¶ӦĴ
-	HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].CMP1xR = CtrValue.BuckDuty * PERIOD>>12; //buckռձ
-  HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].CMP3xR = HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].CMP1xR>>1; //ADC
-	HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_B].CMP1xR = PERIOD - (CtrValue.BoostDuty * PERIOD>>12);//Boostռձ
+	//BuckDuty (Q12) is written to the HRTIM by the caller, see Ctl_Run()
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  void BUCKVLoopInit(int32_t duty)
+**     Description :   Preload all loops with the present duty
+**     Parameters  :duty - present duty, Q12
+**     Returns     :
+** ===================================================================
+*/
+CCMRAM void BUCKVLoopInit(int32_t duty)
+{
+	int32_t u = VIN_FF_ON() ? VinFFInv(duty) : duty;
+
+	BUCKVLoopLimit();
+	Cmp_Init(&VLoop, u);
+	Cmp_Init(&ILoop, u);
+	Cmp_Init(&PLoop, u);
+	Cmp_Init(&VinLoop, u);
+	CtrValue.BuckDuty = duty;
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  void VinFF(int32_t u)
+**     Description :   Vin feedforward
+**       With CTR_FF_EN set in Buck mode (VIN_FF_ON()) the loop output u
+**       is a duty normalised to VIN_FF_NOM; it is rescaled here by the
+**       Vin sampled in this tick, so a line step is compensated in the
+**       same switching period instead of through the loop:
+**         D = u * NOM / Vin
+**       The M4 hardware divide takes at most 12 cycles, so no
+**       reciprocal table is kept.
+**     Parameters  :u - loop output, Q12
+**     Returns     :
+** ===================================================================
+*/
+CCMRAM void VinFF(int32_t u)
+{
+	int32_t vin = SADC.Vin;
+
+	if(vin < VIN_FF_MIN)
+		vin = VIN_FF_MIN;
+	if(u < 0)
+		u = 0;
+
+	CtrValue.BuckDuty = u * VIN_FF_NOM / vin;
+	CtrValue.BoostDuty = MIN_BOOST_DUTY1;
+}
+
+/*
+** ===================================================================
+**     Funtion Name :  int32_t VinFFInv(int32_t duty)
+**     Description :   Normalised loop output that VinFF() maps to the
+**                     present duty, for a bumpless loop start
+**     Parameters  :duty - present buck duty, Q12
+**     Returns     :loop output, Q12
+** ===================================================================
+*/
+CCMRAM int32_t VinFFInv(int32_t duty)
+{
+	int32_t vin = SADC.Vin;
+
+	if(vin < VIN_FF_MIN)
+		vin = VIN_FF_MIN;
+
+	return duty * vin / VIN_FF_NOM;
 }
 
@@ -0,0 +1,128 @@
+/** ===================================================================
+**     File Name   : boot.c
+**     Description : Deferred boot sequence
+**
+**     main() only brings up what the converter needs to regulate:
+**     clocks, HRTIM, ADC, the control ISR and the scheduler tick. The
+**     slow parts, USART2, I2C3 and the OLED with its power-up delays
+**     and byte-wise drawing, are done afterwards by Boot_Task() one
+**     short step per scheduler pass, with the delays taken from the
+**     tick instead of HAL_Delay.
+**
+**     Every phase records its completion time in BootLog, sent once
+**     as a TELE_TYPE_BOOT frame when the display is up.
+** ===================================================================*/
+
+#include "boot.h"
+#include "function.h"
+#include "telemetry.h"
+#include "usart.h"
+#include "i2c.h"
+
+struct _BOOT_LOG BootLog = {{0}, 0};
+
+//Background steps of Boot_Task()
+typedef enum
+{
+	BS_COMMS,
+	BS_I2C,
+	BS_OLED_PWRUP,
+	BS_OLED_ON,
+	BS_OLED_CLS,
+	BS_LAYOUT,
+	BS_DONE
+}BOOT_STEP;
+
+/** ===================================================================
+**     Function Name : void Boot_Start(void)
+**     Description : Start the DWT cycle counter used as boot clock,
+**                   call right after SystemClock_Config()
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Boot_Start(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	Boot_Mark(BOOT_CLOCK);
+}
+
+/** ===================================================================
+**     Function Name : void Boot_Mark(BOOT_PHASE phase)
+**     Description : Record the completion of a boot phase
+**     Parameters  : phase - BOOT_xxx
+**     Returns     :
+** ===================================================================*/
+void Boot_Mark(BOOT_PHASE phase)
+{
+	BootLog.Us[phase] = DWT->CYCCNT / (SystemCoreClock / 1000000);
+	BootLog.Done |= (uint16_t)(1u << phase);
+}
+
+/** ===================================================================
+**     Function Name : void Boot_Task(void)
+**     Description : Background part of the boot, one step per call
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Boot_Task(void)
+{
+	static BOOT_STEP step = BS_COMMS;
+	static uint32_t t0 = 0;
+	static uint8_t n = 0;
+
+	switch(step)
+	{
+	case BS_COMMS:
+		MX_USART2_UART_Init();
+		Tele_RxStart(); // Receive command frames on USART2
+		Boot_Mark(BOOT_COMMS);
+		step = BS_I2C;
+		break;
+
+	case BS_I2C:
+		MX_I2C3_Init();
+		Boot_Mark(BOOT_I2C);
+		IrqPrio_Check(); // All NVIC lines are configured now, mismatches are sent in telemetry
+		step = BS_OLED_PWRUP;
+		break;
+
+	case BS_OLED_PWRUP:
+		if(HAL_GetTick() < OLED_PWRUP_MS)
+			break;
+		OLED_InitSeq();
+		t0 = HAL_GetTick();
+		step = BS_OLED_ON;
+		break;
+
+	case BS_OLED_ON:
+		if(HAL_GetTick() - t0 < OLED_ON_MS)
+			break;
+		n = 0;
+		step = BS_OLED_CLS;
+		break;
+
+	case BS_OLED_CLS:
+		OLED_FillPage(n, 0x00);
+		if(++n < 8)
+			break;
+		Boot_Mark(BOOT_OLED);
+		n = 0;
+		step = BS_LAYOUT;
+		break;
+
+	case BS_LAYOUT:
+		Display_Layout(n);
+		if(++n < DISPLAY_ROWS)
+			break;
+		Boot_Mark(BOOT_DISPLAY);
+		Tele_BootReport();
+		step = BS_DONE;
+		break;
+
+	default:
+		break;
+	}
+}
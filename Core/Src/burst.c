@@ -0,0 +1,173 @@
+/** ===================================================================
+**     File Name   : burst.c
+**     Description : Light load burst mode on the HRTIM burst mode
+**                   controller
+**
+**     The controller runs single shot, clocked by the master period.
+**     A software trigger puts every output with IdleMode IDLE into its
+**     inactive level for up to BURST_IDLE_MAX switching periods; the
+**     timers keep counting, so the control ISR keeps running.
+**
+**     Burst_Isr (control ISR) makes the hysteretic Vout band: above
+**     Voref + BURST_VBAND a burst is triggered, below Voref - BURST_VBAND
+**     a running burst is ended by clearing BMSTAT. While idle the loops
+**     are not run, so switching restarts with the duty it stopped with.
+**
+**     Burst_Task (main loop) engages burst mode after the net output
+**     current stayed below IEnter for BURST_ENTER_PASSES, and leaves it
+**     as soon as the current exceeds BURST_I_EXIT. It also turns the
+**     idle cycle count into Duty, the share of cycles that switched.
+** ===================================================================*/
+
+#include "burst.h"
+#include "hrtim.h"
+#include "telemetry.h"
+
+struct _BURST Burst = {0, 0, 0, BURST_I_ENTER};
+
+typedef char BurstHystCheck[(BURST_I_EXIT > BURST_I_ENTER && BURST_IDLE_MAX < 0xFFFF) ? 1 : -1];
+
+/** ===================================================================
+**     Function Name : void Burst_Init(void)
+**     Description : Configure the burst mode controller, left disabled.
+**                   Call after UpdateHRTIM().
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Burst_Init(void)
+{
+	HRTIM_BurstModeCfgTypeDef burstConfig = {0};
+
+	burstConfig.Mode = HRTIM_BURSTMODE_SINGLESHOT;
+	burstConfig.ClockSource = HRTIM_BURSTMODECLOCKSOURCE_MASTER;//one clock per switching period
+	burstConfig.Prescaler = HRTIM_BURSTMODEPRESCALER_DIV1;
+	burstConfig.PreloadEnable = HRIM_BURSTMODEPRELOAD_ENABLED;
+	burstConfig.Trigger = HRTIM_BURSTMODETRIGGER_NONE;//software trigger only
+	burstConfig.IdleDuration = BURST_IDLE_MAX;
+	burstConfig.Period = BURST_IDLE_MAX + 1;
+	if(HAL_HRTIM_BurstModeConfig(&hhrtim1, &burstConfig) != HAL_OK
+		|| HAL_HRTIM_BurstModeCtl(&hhrtim1, HRTIM_BURSTMODECTL_DISABLED) != HAL_OK)
+	{
+		Error_Handler();
+	}
+}
+
+/** ===================================================================
+**     Function Name : uint8_t Burst_Isr(void)
+**     Description : Hysteretic gating of the switching, control ISR
+**     Parameters  :
+**     Returns     : 1 while the outputs are idle, the loops must hold
+** ===================================================================*/
+CCMRAM uint8_t Burst_Isr(void)
+{
+	uint8_t idle;
+
+	if(!Burst.On)
+		return 0;
+
+	idle = (HRTIM1->sCommonRegs.BMCR & HRTIM_BMCR_BMSTAT) != 0;
+	if(!idle && SADC.VoutAvg > CtrValue.Voref + BURST_VBAND)
+	{
+		HRTIM1->sCommonRegs.BMTRGR = HRTIM_BMTRGR_SW;
+		idle = 1;
+	}
+	else if(idle && SADC.VoutAvg < CtrValue.Voref - BURST_VBAND)
+	{
+		HRTIM1->sCommonRegs.BMCR &= ~HRTIM_BMCR_BMSTAT;//end the idle slice now
+		idle = 0;
+	}
+
+	Burst.Cyc++;
+	if(idle)
+		Burst.IdleCyc++;
+	return idle;
+}
+
+/** ===================================================================
+**     Function Name : void Burst_Engage(uint8_t on)
+**     Description : Switch burst mode on or off. Off ends a running
+**                   idle slice first, so switching resumes at once.
+**     Parameters  : on - 1 engage, 0 release
+**     Returns     :
+** ===================================================================*/
+static void Burst_Engage(uint8_t on)
+{
+	if(on)
+	{
+		HRTIM1->sCommonRegs.BMCR |= HRTIM_BMCR_BME;
+		Burst.On = 1;
+		Burst.Entries++;
+	}
+	else
+	{
+		Burst.On = 0;//no new trigger from the control ISR
+		HRTIM1->sCommonRegs.BMCR &= ~HRTIM_BMCR_BMSTAT;
+		HRTIM1->sCommonRegs.BMCR &= ~HRTIM_BMCR_BME;
+	}
+	Burst.Cnt = 0;
+}
+
+/** ===================================================================
+**     Function Name : void Burst_Task(void)
+**     Description : Load dependent entry/exit and burst duty, scheduled
+**                   every BURST_PERIOD_MS
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Burst_Task(void)
+{
+	static uint32_t lastCyc = 0, lastIdle = 0;
+	struct _SNAP snap;
+	uint32_t cyc, idle;
+	int32_t net;
+
+	cyc = Burst.Cyc;
+	idle = Burst.IdleCyc;
+	if(cyc != lastCyc)
+		Burst.Duty = (uint16_t)(1000 - (idle - lastIdle) * 1000 / (cyc - lastCyc));
+	else
+		Burst.Duty = 1000;
+	lastCyc = cyc;
+	lastIdle = idle;
+
+	Tele_Read(&snap);
+	if(!Burst.Auto || snap.Mode != MODE_CLOSE_LOOP || snap.Flag.ErrFlag != F_NOERR)
+	{
+		if(Burst.On)
+			Burst_Engage(0);
+		Burst.Cnt = 0;
+		return;
+	}
+
+	net = snap.Adc.IoutAvg - 2048;
+	if(Burst.On)
+	{
+		if(net > BURST_I_EXIT)
+			Burst_Engage(0);
+	}
+	else if(net < Burst.IEnter)
+	{
+		if(++Burst.Cnt >= BURST_ENTER_PASSES)
+			Burst_Engage(1);
+	}
+	else
+	{
+		Burst.Cnt = 0;
+	}
+}
+
+/** ===================================================================
+**     Function Name : void Burst_Set(uint8_t en, int16_t ienter)
+**     Description : Enable automatic burst mode and set the entry level
+**     Parameters  : en - 1 auto, 0 off
+**                   ienter - entry threshold, Q12 net Iout, kept below
+**                   BURST_I_EXIT; 0 keeps the present value
+**     Returns     :
+** ===================================================================*/
+void Burst_Set(uint8_t en, int16_t ienter)
+{
+	if(ienter > 0 && ienter < BURST_I_EXIT)
+		Burst.IEnter = ienter;
+	Burst.Auto = en;
+	Burst.Cnt = 0;
+}
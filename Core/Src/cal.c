@@ -0,0 +1,211 @@
+/** ===================================================================
+**     File Name   : cal.c
+**     Description : Per unit ADC calibration, fitted over the command
+**                   interface and kept in a flash page
+**
+**     ADCSample() scales with the RAM table Cal, loaded once at boot
+**     by Cal_Load(): from the flash record if its magic, size and CRC
+**     check, otherwise from the CAL_xxx_K/B build time values.
+**
+**     Procedure, one channel at a time (CMD_CAL):
+**       START ch        select the channel, forget old points
+**       POINT value     apply a known input, send what the meter reads;
+**                       Cal_Task averages the raw ADC over
+**                       CAL_AVG_PASSES and stores the pair
+**       FIT             least squares K/B over the points, 2 or more,
+**                       used right away
+**       SAVE            write the whole table to flash
+**     Every operation, and the end of each point, answers with a
+**     TELE_TYPE_CAL frame.
+** ===================================================================*/
+
+#include "cal.h"
+#include "flash.h"
+#include "telemetry.h"
+#include "string.h"
+#include "stddef.h"
+
+//Flash record, a whole number of double words
+struct _CAL_REC
+{
+	uint32_t	Magic;
+	uint32_t	Size;//sizeof(struct _CAL)
+	struct _CAL	Cal;
+	uint32_t	Crc;//over Magic..Cal
+	uint32_t	Pad;
+};
+
+typedef char CalRecCheck[(sizeof(struct _CAL_REC) % 8 == 0) ? 1 : -1];
+
+static const struct _CAL CalDef =
+{
+	{CAL_VIN_K, CAL_IIN_K, CAL_VOUT_K, CAL_IOUT_K},
+	{CAL_VIN_B, CAL_IIN_B, CAL_VOUT_B, CAL_IOUT_B},
+};
+
+struct _CAL Cal = {
+	{CAL_VIN_K, CAL_IIN_K, CAL_VOUT_K, CAL_IOUT_K},
+	{CAL_VIN_B, CAL_IIN_B, CAL_VOUT_B, CAL_IOUT_B},
+};
+struct _CAL_RUN CalRun = {0};
+
+/** ===================================================================
+**     Function Name : void Cal_Load(void)
+**     Description : Load the flash record into Cal if it is valid, at
+**                   boot before the ADC runs
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Cal_Load(void)
+{
+	struct _CAL_REC rec;
+
+	//a save cut short by a reset fails its ECC, Flash_Read() reports it
+	if(Flash_Read(&rec, FLASH_CAL_ADDR, sizeof(rec)) == HAL_OK
+		&& rec.Magic == CAL_MAGIC && rec.Size == sizeof(struct _CAL)
+		&& rec.Crc == Crc32(&rec, offsetof(struct _CAL_REC, Crc)))
+	{
+		Cal = rec.Cal;
+		CalRun.Stored = 1;
+	}
+	else
+	{
+		Cal = CalDef;
+		CalRun.Stored = 0;
+	}
+}
+
+/** ===================================================================
+**     Function Name : uint8_t Cal_Fit(void)
+**     Description : Least squares line through the points of the
+**                   session channel: y = x x K >> 12 + B
+**     Parameters  :
+**     Returns     : CAL_OK or CAL_ERR_FIT
+** ===================================================================*/
+static uint8_t Cal_Fit(void)
+{
+	int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, den;
+	int32_t k, b;
+	uint8_t n = CalRun.N;
+	uint8_t i;
+
+	if(n < 2)
+		return CAL_ERR_FIT;
+	for(i = 0; i < n; i++)
+	{
+		sx += CalRun.X[i];
+		sy += CalRun.Y[i];
+		sxx += (int64_t)CalRun.X[i] * CalRun.X[i];
+		sxy += (int64_t)CalRun.X[i] * CalRun.Y[i];
+	}
+	den = n * sxx - sx * sx;
+	if(den <= 0)
+		return CAL_ERR_FIT;
+
+	//X is raw x16: K = 16 x 4096 x slope
+	k = (int32_t)(((n * sxy - sx * sy) << 16) / den);
+	if(k < CAL_K_MIN || k > CAL_K_MAX)
+		return CAL_ERR_FIT;
+	b = (int32_t)((sy - ((sx * k) >> 16)) / n);
+
+	Cal.K[CalRun.Ch] = k;
+	Cal.B[CalRun.Ch] = b;
+	return CAL_OK;
+}
+
+/** ===================================================================
+**     Function Name : uint8_t Cal_Save(void)
+**     Description : Write Cal to the calibration page. The page erase
+**                   takes ~20mS in the main loop; the control ISR runs
+**                   on, the page is in the other bank.
+**     Parameters  :
+**     Returns     : CAL_OK or CAL_ERR_FLASH
+** ===================================================================*/
+static uint8_t Cal_Save(void)
+{
+	struct _CAL_REC rec;
+
+	rec.Magic = CAL_MAGIC;
+	rec.Size = sizeof(struct _CAL);
+	rec.Cal = Cal;
+	rec.Crc = Crc32(&rec, offsetof(struct _CAL_REC, Crc));
+	rec.Pad = 0xFFFFFFFFu;
+
+	if(Flash_Erase(FLASH_CAL_ADDR, 1) != HAL_OK
+		|| Flash_Write(FLASH_CAL_ADDR, &rec, sizeof(rec)) != HAL_OK
+		|| memcmp((const void *)FLASH_CAL_ADDR, &rec, sizeof(rec)) != 0)
+		return CAL_ERR_FLASH;
+	CalRun.Stored = 1;
+	return CAL_OK;
+}
+
+/** ===================================================================
+**     Function Name : void Cal_Task(void)
+**     Description : Average the raw ADC for a pending point, scheduled
+**                   every CAL_PERIOD_MS
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Cal_Task(void)
+{
+	if(CalRun.Busy == 0)
+		return;
+
+	CalRun.Sum += ADC1_RESULT[CalRun.Ch];//written by the control ISR, a halfword read is atomic
+	if(--CalRun.Busy)
+		return;
+
+	CalRun.X[CalRun.N] = (int32_t)(CalRun.Sum * 16 / CAL_AVG_PASSES);
+	CalRun.Y[CalRun.N] = CalRun.True;
+	CalRun.N++;
+	CalRun.Result = CAL_OK;
+	Tele_CalReport();
+}
+
+/** ===================================================================
+**     Function Name : void Cal_Cmd(const uint8_t *data, uint8_t len)
+**     Description : CMD_CAL, see the CAL_OP_xxx codes
+**     Parameters  : data - command data, len - bytes
+**     Returns     :
+** ===================================================================*/
+void Cal_Cmd(const uint8_t *data, uint8_t len)
+{
+	uint8_t res = CAL_ERR_ARG;
+
+	if(len >= 1 && CalRun.Busy)
+		res = CAL_ERR_BUSY;
+	else if(len >= 1)
+	{
+		switch(data[0])
+		{
+			case CAL_OP_START:
+				if(len < 2 || data[1] >= CAL_CH_NUM)
+					break;
+				CalRun.Ch = data[1];
+				CalRun.N = 0;
+				res = CAL_OK;
+				break;
+			case CAL_OP_POINT:
+				if(len < 3 || CalRun.N >= CAL_POINTS_MAX)
+					break;
+				CalRun.True = data[1] | (data[2] << 8);
+				CalRun.Sum = 0;
+				CalRun.Busy = CAL_AVG_PASSES;
+				return;//answered when the average is done
+			case CAL_OP_FIT:
+				res = Cal_Fit();
+				break;
+			case CAL_OP_SAVE:
+				res = Cal_Save();
+				break;
+			case CAL_OP_DEFAULT:
+				Cal = CalDef;
+				res = CAL_OK;
+				break;
+			default:
+				break;
+		}
+	}
+	CalRun.Result = res;
+	Tele_CalReport();
+}
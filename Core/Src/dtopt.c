@@ -0,0 +1,196 @@
+/** ===================================================================
+**     File Name   : dtopt.c
+**     Description : Adaptive per leg dead time
+**
+**     With the output held by the closed loop, a dead time that is too
+**     long lets the body diode conduct and a too short one adds
+**     switching loss; both show up as input power. The optimizer
+**     perturbs the dead time of one leg at a time by DTOPT_STEP and
+**     keeps the step if Pin drops by more than DTOPT_PIN_HYST while Pout
+**     stays within DTOPT_POUT_TOL; otherwise it goes back and reverses
+**     that leg's direction. A measurement during which Pout moved is
+**     thrown away, so load steps do not walk the dead time.
+**
+**     Results are kept per Pout bucket and loaded again when the load
+**     returns to it. gDtLeg[] never goes below DT_MIN_TICKS here, and
+**     HRTIM_Apply() enforces the same floor on whatever it is given.
+**     The search pauses while the frequency search is running, the two
+**     would measure each other's steps.
+** ===================================================================*/
+
+#include "dtopt.h"
+#include "freqopt.h"
+#include "telemetry.h"
+
+struct _DTOPT DtOpt = {DT_MODE_FIXED, 0xFF, 0, 0, 1, 0, {1, 1}};
+
+/** ===================================================================
+**     Function Name : int32_t DtOpt_Clamp(int32_t dt)
+**     Description : Keep a dead time inside DT_MIN_TICKS..DT_MAX_TICKS
+**     Parameters  : dt - HRTIM ticks
+**     Returns     : clamped value
+** ===================================================================*/
+static int32_t DtOpt_Clamp(int32_t dt)
+{
+	if(dt < DT_MIN_TICKS)
+		return DT_MIN_TICKS;
+	if(dt > DT_MAX_TICKS)
+		return DT_MAX_TICKS;
+	return dt;
+}
+
+/** ===================================================================
+**     Function Name : void DtOpt_Restart(void)
+**     Description : Undo a pending perturbation and start over with a
+**                   settle phase
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void DtOpt_Restart(void)
+{
+	if(DtOpt.Try)
+		gDtLeg[DtOpt.Leg] = DtOpt.Old;
+	DtOpt.Try = 0;
+	DtOpt.Settle = 1;
+	DtOpt.Cnt = 0;
+}
+
+/** ===================================================================
+**     Function Name : void DtOpt_Set(uint8_t mode, int32_t dta, int32_t dtb)
+**     Description : Select the dead time mode
+**     Parameters  : mode - DT_MODE_xxx, dta/dtb - leg dead times in
+**                   HRTIM ticks for DT_MODE_LEG (<= 0 keeps the value)
+**     Returns     :
+** ===================================================================*/
+void DtOpt_Set(uint8_t mode, int32_t dta, int32_t dtb)
+{
+	DtOpt_Restart();
+	DtOpt.Bkt = 0xFF;
+
+	if(mode == DT_MODE_LEG)
+	{
+		if(dta > 0)
+			gDtLeg[0] = DtOpt_Clamp(dta);
+		if(dtb > 0)
+			gDtLeg[1] = DtOpt_Clamp(dtb);
+	}
+	DtOpt.Mode = mode;
+	if(mode == DT_MODE_FIXED)
+		DF.CtrFlag &= ~CTR_DT_LEG;
+	else
+		DF.CtrFlag |= CTR_DT_LEG;
+}
+
+/** ===================================================================
+**     Function Name : void DtOpt_Load(uint8_t bkt)
+**     Description : The load moved to another bucket: keep the result
+**                   of the old one, continue from the stored values of
+**                   the new one
+**     Parameters  : bkt - new load bucket
+**     Returns     :
+** ===================================================================*/
+static void DtOpt_Load(uint8_t bkt)
+{
+	uint8_t i;
+
+	for(i = 0; i < 2; i++)
+	{
+		if(DtOpt.Bkt < DTOPT_BUCKETS)
+			DtOpt.Tab[DtOpt.Bkt][i] = (uint16_t)gDtLeg[i];
+		if(DtOpt.Tab[bkt][i] != 0)
+			gDtLeg[i] = DtOpt.Tab[bkt][i];
+	}
+	DtOpt.Bkt = bkt;
+}
+
+/** ===================================================================
+**     Function Name : void DtOpt_Task(void)
+**     Description : Scheduled every DTOPT_PERIOD_MS, main loop context.
+**                   Idle unless DT_MODE_ADAPT, closed loop and no fault.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void DtOpt_Task(void)
+{
+	struct _SNAP snap;
+	uint32_t bkt;
+	int32_t dt;
+
+	if(DtOpt.Mode != DT_MODE_ADAPT || currentMode != MODE_CLOSE_LOOP || DF.ErrFlag != F_NOERR
+		|| FreqOpt.Search)
+	{
+		DtOpt_Restart();
+		return;
+	}
+
+	if(DtOpt.Settle)
+	{
+		if(++DtOpt.Cnt < DTOPT_SETTLE)
+			return;
+		DtOpt.Settle = 0;
+		DtOpt.Cnt = 0;
+		DtOpt.PinSum = 0;
+		DtOpt.PoutSum = 0;
+		return;
+	}
+
+	Tele_Read(&snap);
+	DtOpt.PinSum += snap.Adc.VinAvg * (snap.Adc.IinAvg - 2048) >> 11;
+	DtOpt.PoutSum += snap.Adc.VoutAvg * (snap.Adc.IoutAvg - 2048) >> 11;
+	if(++DtOpt.Cnt < DTOPT_MEASURE)
+		return;
+	DtOpt.Settle = 1;
+	DtOpt.Cnt = 0;
+
+	if(DtOpt.PinSum < DTOPT_PIN_MIN * DTOPT_MEASURE)
+	{
+		DtOpt_Restart();
+		return;
+	}
+
+	bkt = (uint32_t)(DtOpt.PoutSum / DTOPT_MEASURE) * DTOPT_BUCKETS >> 12;
+	if(bkt >= DTOPT_BUCKETS)
+		bkt = DTOPT_BUCKETS - 1;
+	if(bkt != DtOpt.Bkt)
+	{
+		DtOpt_Restart();
+		DtOpt_Load((uint8_t)bkt);
+		return;
+	}
+
+	if(DtOpt.Try)
+	{
+		DtOpt.Try = 0;
+		if(DtOpt.PoutSum > DtOpt.PoutBase + DTOPT_POUT_TOL || DtOpt.PoutSum < DtOpt.PoutBase - DTOPT_POUT_TOL)
+		{
+			gDtLeg[DtOpt.Leg] = DtOpt.Old;//output moved, measurement void
+			DtOpt.Rejects++;
+			return;
+		}
+		if(DtOpt.PinSum < DtOpt.PinBase - DTOPT_PIN_HYST)
+		{
+			DtOpt.Tab[bkt][DtOpt.Leg] = (uint16_t)gDtLeg[DtOpt.Leg];
+			DtOpt.Steps++;
+		}
+		else
+		{
+			gDtLeg[DtOpt.Leg] = DtOpt.Old;
+			DtOpt.Dir[DtOpt.Leg] = (int8_t)-DtOpt.Dir[DtOpt.Leg];
+		}
+		DtOpt.Leg ^= 1;
+		return;
+	}
+
+	//Baseline taken, perturb the next leg
+	DtOpt.PinBase = DtOpt.PinSum;
+	DtOpt.PoutBase = DtOpt.PoutSum;
+	DtOpt.Old = gDtLeg[DtOpt.Leg];
+	dt = DtOpt_Clamp(DtOpt.Old + DtOpt.Dir[DtOpt.Leg] * DTOPT_STEP);
+	if(dt == DtOpt.Old)
+	{
+		DtOpt.Dir[DtOpt.Leg] = (int8_t)-DtOpt.Dir[DtOpt.Leg];
+		dt = DtOpt_Clamp(DtOpt.Old + DtOpt.Dir[DtOpt.Leg] * DTOPT_STEP);
+	}
+	gDtLeg[DtOpt.Leg] = dt;
+	DtOpt.Try = 1;
+}
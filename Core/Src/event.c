@@ -0,0 +1,77 @@
+/** ===================================================================
+**     File Name   : event.c
+**     Description : Lock-free SPSC event queues between interrupt
+**                   context and the main loop
+**
+**     Each queue has exactly one producer context and one consumer
+**     context. The producer writes the element first and publishes it
+**     by advancing Head; the consumer reads it and releases the slot by
+**     advancing Tail. On the single Cortex-M4 core a DMB between the
+**     data and the index update is enough, no interrupt masking needed.
+** ===================================================================*/
+
+#include "event.h"
+#include "telemetry.h"
+#include "string.h"
+
+EVQ_DEFINE(KeyEvQ, struct _EVENT, 8);
+EVQ_DEFINE(CtlEvQ, struct _EVENT, 8);
+EVQ_DEFINE(CmdQ, struct _CMD_FRAME, 4);
+EVQ_DEFINE(AppEvQ, struct _EVENT, 4);
+
+/** ===================================================================
+**     Function Name : uint8_t EvQ_Push(struct _EVQ *q, const void *item)
+**     Description : Append one element, producer side only
+**     Parameters  : q - queue, item - element to copy in
+**     Returns     : 1 on success, 0 if the queue is full (counted in Drop)
+** ===================================================================*/
+CCMRAM uint8_t EvQ_Push(struct _EVQ *q, const void *item)
+{
+	uint16_t head = q->Head;
+	uint16_t used = (uint16_t)(head - q->Tail);
+
+	if(used > q->Mask)
+	{
+		q->Drop++;
+		return 0;
+	}
+
+	memcpy(&q->Buf[(head & q->Mask) * q->Size], item, q->Size);
+	__DMB();//element visible before the index
+	q->Head = (uint16_t)(head + 1);
+
+	if(used + 1 > q->HighWater)
+		q->HighWater = used + 1;
+	return 1;
+}
+
+/** ===================================================================
+**     Function Name : uint8_t EvQ_Pop(struct _EVQ *q, void *item)
+**     Description : Remove the oldest element, consumer side only
+**     Parameters  : q - queue, item - destination
+**     Returns     : 1 if an element was copied out, 0 if empty
+** ===================================================================*/
+uint8_t EvQ_Pop(struct _EVQ *q, void *item)
+{
+	uint16_t tail = q->Tail;
+
+	if(tail == q->Head)
+		return 0;
+
+	__DMB();//index read before the element
+	memcpy(item, &q->Buf[(tail & q->Mask) * q->Size], q->Size);
+	__DMB();//element read before the slot is released
+	q->Tail = (uint16_t)(tail + 1);
+	return 1;
+}
+
+/** ===================================================================
+**     Function Name : uint16_t EvQ_Count(const struct _EVQ *q)
+**     Description : Number of queued elements (snapshot)
+**     Parameters  : q - queue
+**     Returns     : fill level
+** ===================================================================*/
+uint16_t EvQ_Count(const struct _EVQ *q)
+{
+	return (uint16_t)(q->Head - q->Tail);
+}
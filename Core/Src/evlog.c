@@ -0,0 +1,206 @@
+/** ===================================================================
+**     File Name   : evlog.c
+**     Description : Fault and event log kept in flash
+**
+**     A record holds the event code, DF flags, the sampled values,
+**     duty, period and uptime. The control ISR fills one in Log_Isr()
+**     and pushes it into LogIsrQ; the main loop does the same through
+**     Log_App() and LogAppQ (one producer per queue). Log_Task numbers
+**     the queued records and programs them in a batch.
+**
+**     The FLASH_LOG_PAGES pages are one ring of LOG_NUM records. The
+**     page ahead of the writer is erased when the writer enters it, so
+**     the oldest page is given up for the new records. At boot the
+**     record with the highest number marks the write position; there
+**     is no page header. Records are read through Flash_Read(), so one
+**     left half programmed by a reset (bad ECC) is skipped.
+**
+**     CMD_GET_LOG reads the ring back over the UART, newest first, in
+**     TELE_TYPE_LOG frames; Tools/evlog.py decodes them.
+** ===================================================================*/
+
+#include "evlog.h"
+#include "flash.h"
+#include "event.h"
+#include "sched.h"
+#include "telemetry.h"
+#include "stddef.h"
+
+#define LOG_PER_PAGE	(FLASH_PAGE_SIZE / sizeof(struct _LOG_REC))
+#define LOG_NUM		(FLASH_LOG_PAGES * LOG_PER_PAGE)
+
+typedef char LogRecCheck[(sizeof(struct _LOG_REC) == 32) ? 1 : -1];
+
+EVQ_DEFINE(LogIsrQ, struct _LOG_REC, 8);//control ISR -> Log_Task
+EVQ_DEFINE(LogAppQ, struct _LOG_REC, 8);//main loop -> Log_Task
+
+struct _LOG Log = {1, 0, 0, 0, 0};
+
+static uint32_t Log_Slot(uint16_t slot)
+{
+	return FLASH_LOG_ADDR + (uint32_t)slot * sizeof(struct _LOG_REC);
+}
+
+static uint16_t Log_Chk(const struct _LOG_REC *rec)
+{
+	return (uint16_t)Crc32(rec, offsetof(struct _LOG_REC, Chk));
+}
+
+/** ===================================================================
+**     Function Name : void Log_Init(void)
+**     Description : Find the newest record, then log the boot with the
+**                   reset cause; at boot, main loop
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Log_Init(void)
+{
+	struct _LOG_REC rec;
+	uint32_t top = 0;
+	uint16_t i;
+
+	for(i = 0; i < LOG_NUM; i++)
+	{
+		if(Flash_Read(&rec, Log_Slot(i), sizeof(rec)) != HAL_OK)
+			continue;
+		if(rec.Seq == 0xFFFFFFFFu || rec.Chk != Log_Chk(&rec))
+			continue;
+		Log.Count++;
+		if(rec.Seq > top)
+		{
+			top = rec.Seq;
+			Log.Pos = (uint16_t)((i + 1) % LOG_NUM);
+		}
+	}
+	Log.Seq = top + 1;
+
+	Log_App(LOG_BOOT, (uint16_t)(RCC->CSR >> 24));
+	__HAL_RCC_CLEAR_RESET_FLAGS();
+}
+
+/** ===================================================================
+**     Function Name : void Log_Isr(uint16_t code, uint16_t arg)
+**     Description : Queue a record, control ISR only
+**     Parameters  : code - LOG_xxx, arg - event argument
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Log_Isr(uint16_t code, uint16_t arg)
+{
+	struct _LOG_REC rec;
+
+	rec.Ms = SchedTick / (1000 / SCHED_TICK_US);
+	rec.Code = code;
+	rec.Arg = arg;
+	rec.ErrFlag = DF.ErrFlag;
+	rec.CtrFlag = DF.CtrFlag;
+	rec.Vin = (uint16_t)SADC.Vin;
+	rec.Iin = (uint16_t)SADC.Iin;
+	rec.Vout = (uint16_t)SADC.Vout;
+	rec.Iout = (uint16_t)SADC.Iout;
+	rec.Duty = (uint16_t)gDuty;
+	rec.Perioid = (uint16_t)gPerioid;
+	rec.Mode = currentMode;
+	rec.BBFlag = DF.BBFlag;
+	EvQ_Push(&LogIsrQ, &rec);
+}
+
+/** ===================================================================
+**     Function Name : void Log_App(uint16_t code, uint16_t arg)
+**     Description : Queue a record, main loop only; the values come
+**                   from a consistent snapshot
+**     Parameters  : code - LOG_xxx, arg - event argument
+**     Returns     :
+** ===================================================================*/
+void Log_App(uint16_t code, uint16_t arg)
+{
+	struct _LOG_REC rec;
+	struct _SNAP snap;
+
+	Tele_Read(&snap);
+	rec.Ms = SchedTick / (1000 / SCHED_TICK_US);
+	rec.Code = code;
+	rec.Arg = arg;
+	rec.ErrFlag = DF.ErrFlag;//may have changed after the snapshot
+	rec.CtrFlag = snap.Flag.CtrFlag;
+	rec.Vin = (uint16_t)snap.Adc.Vin;
+	rec.Iin = (uint16_t)snap.Adc.Iin;
+	rec.Vout = (uint16_t)snap.Adc.Vout;
+	rec.Iout = (uint16_t)snap.Adc.Iout;
+	rec.Duty = (uint16_t)snap.Duty;
+	rec.Perioid = (uint16_t)snap.Perioid;
+	rec.Mode = snap.Mode;
+	rec.BBFlag = snap.Flag.BBFlag;
+	EvQ_Push(&LogAppQ, &rec);
+}
+
+/** ===================================================================
+**     Function Name : void Log_Write(struct _LOG_REC *rec)
+**     Description : Number one record and program it at the write
+**                   position, erasing the page when entering it
+**     Parameters  : rec - record, Seq and Chk are filled in here
+**     Returns     :
+** ===================================================================*/
+static void Log_Write(struct _LOG_REC *rec)
+{
+	uint32_t addr = Log_Slot(Log.Pos);
+
+	if(Log.Pos % LOG_PER_PAGE == 0)
+	{
+		if(Flash_Erase(addr, 1) != HAL_OK)
+		{
+			Log.Failed++;
+			return;
+		}
+		if(Log.Count > LOG_NUM - LOG_PER_PAGE)
+			Log.Count = LOG_NUM - LOG_PER_PAGE;
+	}
+
+	rec->Seq = Log.Seq;
+	rec->Chk = Log_Chk(rec);
+	Log.Pos = (uint16_t)((Log.Pos + 1) % LOG_NUM);//a failed slot is skipped
+	if(Flash_Write(addr, rec, sizeof(*rec)) != HAL_OK)
+	{
+		Log.Failed++;
+		return;
+	}
+	Log.Seq++;
+	if(Log.Count < LOG_NUM)
+		Log.Count++;
+	Log.Written++;
+}
+
+/** ===================================================================
+**     Function Name : void Log_Task(void)
+**     Description : Write the queued records, up to LOG_BATCH a pass,
+**                   ISR records first; scheduled every LOG_PERIOD_MS
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Log_Task(void)
+{
+	struct _LOG_REC rec;
+	uint8_t n;
+
+	for(n = 0; n < LOG_BATCH; n++)
+	{
+		if(!EvQ_Pop(&LogIsrQ, &rec) && !EvQ_Pop(&LogAppQ, &rec))
+			break;
+		Log_Write(&rec);
+	}
+}
+
+/** ===================================================================
+**     Function Name : uint8_t Log_Read(uint16_t back, struct _LOG_REC *dst)
+**     Description : Copy one record, counted back from the newest
+**     Parameters  : back - 0 newest, Log.Count - 1 oldest
+**                   dst - destination
+**     Returns     : 1 if a valid record was copied
+** ===================================================================*/
+uint8_t Log_Read(uint16_t back, struct _LOG_REC *dst)
+{
+	if(back >= Log.Count)
+		return 0;
+	if(Flash_Read(dst, Log_Slot((uint16_t)((Log.Pos + LOG_NUM - 1 - back) % LOG_NUM)), sizeof(*dst)) != HAL_OK)
+		return 0;
+	return dst->Chk == Log_Chk(dst);
+}
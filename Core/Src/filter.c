@@ -0,0 +1,178 @@
+/** ===================================================================
+**     File Name   : filter.c
+**     Description : Measurement filter bank
+**
+**     ADCSample() (Vout, every tick) and ADCAverage() (the others,
+**     every CTL_HK_DIV ticks) run one filter per channel in the control
+**     ISR and store the result in the xxxAvg fields. Every filter is integer
+**     only and O(1) per sample:
+**       IIR1  Acc += x - (Acc >> Shift), y = Acc >> Shift
+**       IIR2  two IIR1 poles in series, same Shift
+**       BOX   Sum += x - oldest, y = Sum >> Shift, 2^Shift samples
+**       MED3/MED5  median of the last 3/5 samples, removes single
+**             (MED5: double) sample spikes without smearing them
+**     The default IIR1 with Shift 2 is the filter ADCSample() always
+**     used, started from zero as before.
+**
+**     Filt_Set() (main loop) only posts the new setting in Req; the
+**     control ISR applies it before the next sample and fills the
+**     state with that sample, so a change never shows a step through
+**     an empty history. Each run is timed with the DWT cycle counter.
+** ===================================================================*/
+
+#include "filter.h"
+
+struct _FILT Filt[FILT_CH_NUM] =
+{
+	{FILT_IIR1, 2, 0, FILT_REQ_NONE},
+	{FILT_IIR1, 2, 0, FILT_REQ_NONE},
+	{FILT_IIR1, 2, 0, FILT_REQ_NONE},
+	{FILT_IIR1, 2, 0, FILT_REQ_NONE},
+};
+
+typedef char FiltBufCheck[(FILT_BUF_LEN >= 5 && FILT_SHIFT_MAX < 16) ? 1 : -1];
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+static int32_t Med3(int32_t a, int32_t b, int32_t c)
+{
+	return MAX(MIN(a, b), MIN(MAX(a, b), c));
+}
+
+/** ===================================================================
+**     Function Name : int32_t Med5(const int32_t *v)
+**     Description : Median of five, six compare/exchange steps
+**     Parameters  : v - five samples
+**     Returns     : median
+** ===================================================================*/
+static int32_t Med5(const int32_t *v)
+{
+	int32_t a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], t;
+
+	if(a > b) {t = a; a = b; b = t;}
+	if(c > d) {t = c; c = d; d = t;}
+	if(a > c) {t = b; b = d; d = t; c = a;}//drop the smallest of a, c
+	a = e;
+	if(a > b) {t = a; a = b; b = t;}
+	if(a > c) {t = b; b = d; d = t; c = a;}//drop the smallest again
+	return MIN(c, b);
+}
+
+/** ===================================================================
+**     Function Name : void Filt_Seed(struct _FILT *f, int32_t x)
+**     Description : Take over a posted setting and fill the state with x
+**     Parameters  : f - filter, x - present sample
+**     Returns     :
+** ===================================================================*/
+static void Filt_Seed(struct _FILT *f, int32_t x)
+{
+	uint8_t i;
+
+	f->Type = f->Req & 0x0F;
+	f->Shift = f->Req >> 4;
+	f->Idx = 0;
+	for(i = 0; i < FILT_BUF_LEN; i++)
+		f->Buf[i] = x;
+	f->Acc[0] = x << f->Shift;
+	f->Acc[1] = x << f->Shift;
+	f->CycMax = 0;
+	f->Req = FILT_REQ_NONE;
+}
+
+/** ===================================================================
+**     Function Name : int32_t Filt_Run(struct _FILT *f, int32_t x)
+**     Description : Filter one sample, control ISR
+**     Parameters  : f - filter, x - new sample, Q12
+**     Returns     : filtered value
+** ===================================================================*/
+CCMRAM int32_t Filt_Run(struct _FILT *f, int32_t x)
+{
+	uint32_t start = DWT->CYCCNT;
+	int32_t y;
+
+	if(f->Req != FILT_REQ_NONE)
+		Filt_Seed(f, x);
+
+	switch(f->Type)
+	{
+		case FILT_IIR1:
+			f->Acc[0] += x - (f->Acc[0] >> f->Shift);
+			y = f->Acc[0] >> f->Shift;
+			break;
+		case FILT_IIR2:
+			f->Acc[0] += x - (f->Acc[0] >> f->Shift);
+			f->Acc[1] += (f->Acc[0] >> f->Shift) - (f->Acc[1] >> f->Shift);
+			y = f->Acc[1] >> f->Shift;
+			break;
+		case FILT_BOX:
+			f->Acc[0] += x - f->Buf[f->Idx];
+			f->Buf[f->Idx] = x;
+			f->Idx = (f->Idx + 1) & ((1 << f->Shift) - 1);
+			y = f->Acc[0] >> f->Shift;
+			break;
+		case FILT_MED3:
+			f->Buf[f->Idx] = x;
+			f->Idx = (f->Idx == 2) ? 0 : f->Idx + 1;
+			y = Med3(f->Buf[0], f->Buf[1], f->Buf[2]);
+			break;
+		case FILT_MED5:
+			f->Buf[f->Idx] = x;
+			f->Idx = (f->Idx == 4) ? 0 : f->Idx + 1;
+			y = Med5(f->Buf);
+			break;
+		default:
+			y = x;
+			break;
+	}
+
+	f->Cyc = (uint16_t)(DWT->CYCCNT - start);
+	if(f->Cyc > f->CycMax)
+		f->CycMax = f->Cyc;
+	return y;
+}
+
+/** ===================================================================
+**     Function Name : uint8_t Filt_Set(uint8_t ch, uint8_t type, uint8_t shift)
+**     Description : Select the filter of a channel, main loop
+**     Parameters  : ch - CAL_xxx channel, type - FILT_xxx
+**                   shift - IIR pole shift 1..FILT_SHIFT_MAX, BOX log2
+**                   length 1..FILT_BOX_MAX, ignored otherwise
+**     Returns     : 1 if accepted
+** ===================================================================*/
+uint8_t Filt_Set(uint8_t ch, uint8_t type, uint8_t shift)
+{
+	if(ch >= FILT_CH_NUM || type > FILT_MED5)
+		return 0;
+	if(type == FILT_IIR1 || type == FILT_IIR2)
+	{
+		if(shift < 1 || shift > FILT_SHIFT_MAX)
+			return 0;
+	}
+	else if(type == FILT_BOX)
+	{
+		if(shift < 1 || shift > FILT_BOX_MAX)
+			return 0;
+	}
+	else
+		shift = 0;
+
+	Filt[ch].Req = (uint8_t)(type | (shift << 4));
+	return 1;
+}
+
+/** ===================================================================
+**     Function Name : uint16_t Filt_Cycles(void)
+**     Description : Worst case cycles of the whole bank per sample
+**     Parameters  :
+**     Returns     : sum of CycMax over the channels
+** ===================================================================*/
+uint16_t Filt_Cycles(void)
+{
+	uint16_t sum = 0;
+	uint8_t i;
+
+	for(i = 0; i < FILT_CH_NUM; i++)
+		sum += Filt[i].CycMax;
+	return sum;
+}
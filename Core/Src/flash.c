@@ -0,0 +1,158 @@
+/** ===================================================================
+**     File Name   : flash.c
+**     Description : Page erase, double word programming and CRC for
+**                   the data pages at the top of the flash
+**
+**     All writes are 64 bit double words, the smallest unit the G4
+**     flash (with ECC) can program. A double word may be programmed
+**     once after an erase.
+**
+**     A program cut short by a reset leaves a double word whose ECC does
+**     not match; reading it raises a double ECC error, which is an NMI.
+**     Flash_EccNmi() takes that NMI for the data pages and counts it, so
+**     the scans at boot read through Flash_Read() and skip such a word
+**     instead of stopping in the handler on every later boot.
+** ===================================================================*/
+
+#include "flash.h"
+#include "string.h"
+
+struct _FLASH_ECC FlashEcc = {0, 0};
+
+/** ===================================================================
+**     Function Name : HAL_StatusTypeDef Flash_Erase(uint32_t addr, uint8_t pages)
+**     Description : Erase whole pages, main loop only
+**     Parameters  : addr - start of the first page
+**                   pages - number of pages
+**     Returns     : HAL_OK, or the HAL error of the erase
+** ===================================================================*/
+HAL_StatusTypeDef Flash_Erase(uint32_t addr, uint8_t pages)
+{
+	FLASH_EraseInitTypeDef erase = {0};
+	HAL_StatusTypeDef status;
+	uint32_t bankBase;
+	uint32_t err = 0;
+
+	if(addr >= FLASH_BASE + FLASH_BANK_SIZE)
+	{
+		erase.Banks = FLASH_BANK_2;
+		bankBase = FLASH_BASE + FLASH_BANK_SIZE;
+	}
+	else
+	{
+		erase.Banks = FLASH_BANK_1;
+		bankBase = FLASH_BASE;
+	}
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Page = (addr - bankBase) / FLASH_PAGE_SIZE;
+	erase.NbPages = pages;
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+	status = HAL_FLASHEx_Erase(&erase, &err);
+	HAL_FLASH_Lock();
+	return status;
+}
+
+/** ===================================================================
+**     Function Name : HAL_StatusTypeDef Flash_Write(uint32_t addr, const void *src, uint32_t len)
+**     Description : Program erased flash, main loop only. A tail that
+**                   is not a whole double word is padded with 0xFF.
+**     Parameters  : addr - destination, double word aligned
+**                   src - data, len - bytes
+**     Returns     : HAL_OK, or the HAL error of the first failed word
+** ===================================================================*/
+HAL_StatusTypeDef Flash_Write(uint32_t addr, const void *src, uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)src;
+	HAL_StatusTypeDef status = HAL_OK;
+	uint64_t dw;
+	uint32_t n;
+
+	if(addr & 7u)
+		return HAL_ERROR;
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+	while(len && status == HAL_OK)
+	{
+		n = (len < 8) ? len : 8;
+		dw = 0xFFFFFFFFFFFFFFFFull;
+		memcpy(&dw, p, n);
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr, dw);
+		addr += 8;
+		p += n;
+		len -= n;
+	}
+	HAL_FLASH_Lock();
+	return status;
+}
+
+/** ===================================================================
+**     Function Name : HAL_StatusTypeDef Flash_Read(void *dst, uint32_t addr, uint32_t len)
+**     Description : Copy from the data pages, detecting double ECC
+**                   errors; main loop only
+**     Parameters  : dst - destination, addr - flash address, len - bytes
+**     Returns     : HAL_OK, HAL_ERROR if a double word of the range
+**                   failed its ECC (dst then holds garbage)
+** ===================================================================*/
+HAL_StatusTypeDef Flash_Read(void *dst, uint32_t addr, uint32_t len)
+{
+	uint32_t cnt = FlashEcc.Cnt;
+
+	memcpy(dst, (const void *)addr, len);
+	__DSB();//the NMI of a failed read is taken before the count is checked
+	return (FlashEcc.Cnt == cnt) ? HAL_OK : HAL_ERROR;
+}
+
+/** ===================================================================
+**     Function Name : uint8_t Flash_EccNmi(void)
+**     Description : Take a double ECC error on a data page read, from
+**                   NMI_Handler(). The flag is cleared and the read
+**                   goes on with the uncorrected data, Flash_Read()
+**                   reports it. An error in code or system memory is
+**                   left to the handler.
+**     Parameters  :
+**     Returns     : 1 if handled
+** ===================================================================*/
+uint8_t Flash_EccNmi(void)
+{
+	uint32_t eccr = FLASH->ECCR;
+	uint32_t addr;
+
+	if((eccr & FLASH_ECCR_ECCD) == 0 || (eccr & FLASH_ECCR_SYSF_ECC))
+		return 0;
+
+	addr = FLASH_BASE + ((eccr & FLASH_ECCR_ADDR_ECC) & ~7u);
+	if(eccr & FLASH_ECCR_BK_ECC)
+		addr += FLASH_BANK_SIZE;
+	if(addr < FLASH_LOG_ADDR || addr >= FLASH_DATA_END)
+		return 0;
+
+	FlashEcc.Addr = addr;
+	FlashEcc.Cnt++;
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ECCD);
+	return 1;
+}
+
+/** ===================================================================
+**     Function Name : uint32_t Crc32(const void *src, uint32_t len)
+**     Description : CRC-32 (IEEE 802.3, reflected, as zlib), bitwise;
+**                   only used on short records, so no table
+**     Parameters  : src - data, len - bytes
+**     Returns     : CRC
+** ===================================================================*/
+uint32_t Crc32(const void *src, uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)src;
+	uint32_t crc = 0xFFFFFFFFu;
+	uint8_t i;
+
+	while(len--)
+	{
+		crc ^= *p++;
+		for(i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+	}
+	return ~crc;
+}
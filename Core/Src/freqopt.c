@@ -0,0 +1,229 @@
+/** ===================================================================
+**     File Name   : freqopt.c
+**     Description : Efficiency-optimal switching frequency search
+**
+**     In closed loop the efficiency Pout/Pin is measured from the
+**     averaged samples over FOPT_MEASURE passes, after FOPT_SETTLE
+**     passes were given to the loop to settle on the new period. The
+**     load is sorted into FOPT_BUCKETS buckets by Pout.
+**
+**     For a bucket without a stored result a hill climb runs on the
+**     period: step by FOPT_STEP while the efficiency rises by more than
+**     FOPT_EFF_HYST, reverse once if the first step already loses, stop
+**     at the first loss after that. The best period is stored for the
+**     bucket and applied directly whenever the load comes back to it.
+**     A load change to another bucket aborts a running search.
+**
+**     The period is handed to the control ISR through Freq_Request(),
+**     which applies it together with the duty of the same cycle, and
+**     the HRTIM takes both over at the next period boundary (preload).
+** ===================================================================*/
+
+#include "freqopt.h"
+#include "telemetry.h"
+
+struct _FOPT FreqOpt = {0, 0, 0xFF};
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Goto(int32_t per)
+**     Description : Request a period and wait for the loop to settle
+**     Parameters  : per - HRTIM period
+**     Returns     :
+** ===================================================================*/
+static void FreqOpt_Goto(int32_t per)
+{
+	FreqOpt.Per = per;
+	FreqOpt.Settle = 1;
+	FreqOpt.Cnt = 0;
+	Freq_Request(per);
+}
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Finish(void)
+**     Description : Store the result of the running search and go to
+**                   the best period
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void FreqOpt_Finish(void)
+{
+	FreqOpt.Tab[FreqOpt.Bkt].Per = (uint16_t)FreqOpt.BestPer;
+	FreqOpt.Tab[FreqOpt.Bkt].Eff = FreqOpt.BestEff;
+	FreqOpt.Search = 0;
+	FreqOpt.Searches++;
+	if(FreqOpt.Per != FreqOpt.BestPer)
+		FreqOpt_Goto(FreqOpt.BestPer);
+}
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Step(void)
+**     Description : One hill climb step after a measurement in the
+**                   bucket being searched
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void FreqOpt_Step(void)
+{
+	int32_t next;
+
+	if(FreqOpt.Eff > FreqOpt.BestEff + FOPT_EFF_HYST)
+	{
+		FreqOpt.BestPer = FreqOpt.Per;
+		FreqOpt.BestEff = FreqOpt.Eff;
+	}
+	else if(!FreqOpt.Rev && FreqOpt.BestPer == FreqOpt.StartPer)
+	{
+		FreqOpt.Rev = 1;//first step lost, try the other side
+		FreqOpt.Dir = (int8_t)-FreqOpt.Dir;
+	}
+	else
+	{
+		FreqOpt_Finish();
+		return;
+	}
+
+	next = FreqOpt.BestPer + FreqOpt.Dir * FOPT_STEP;
+	if(next < FreqMin || next > FreqMax)
+	{
+		if(FreqOpt.Rev || FreqOpt.BestPer != FreqOpt.StartPer)
+		{
+			FreqOpt_Finish();
+			return;
+		}
+		FreqOpt.Rev = 1;//start at the range end, only one side to look at
+		FreqOpt.Dir = (int8_t)-FreqOpt.Dir;
+		next = FreqOpt.BestPer + FreqOpt.Dir * FOPT_STEP;
+	}
+	FreqOpt_Goto(next);
+}
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Load(uint8_t bkt)
+**     Description : The load moved to another bucket: abort a running
+**                   search, then use the stored period or start a new
+**                   search from the present one
+**     Parameters  : bkt - new load bucket
+**     Returns     :
+** ===================================================================*/
+static void FreqOpt_Load(uint8_t bkt)
+{
+	FreqOpt.Bkt = bkt;
+	FreqOpt.Search = 0;
+
+	if(FreqOpt.Tab[bkt].Per != 0)
+	{
+		if(FreqOpt.Tab[bkt].Per != FreqOpt.Per)
+			FreqOpt_Goto(FreqOpt.Tab[bkt].Per);
+		return;
+	}
+
+	FreqOpt.Search = 1;
+	FreqOpt.Rev = 0;
+	FreqOpt.Dir = (FreqOpt.Per + FOPT_STEP <= FreqMax) ? 1 : -1;
+	FreqOpt.StartPer = FreqOpt.Per;
+	FreqOpt.BestPer = FreqOpt.Per;
+	FreqOpt.BestEff = FreqOpt.Eff;
+	FreqOpt_Goto(FreqOpt.Per + FreqOpt.Dir * FOPT_STEP);
+}
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Enable(uint8_t en)
+**     Description : Switch the optimizer on or off. Off stops a running
+**                   search at the best period found so far.
+**     Parameters  : en - 1 on, 0 off
+**     Returns     :
+** ===================================================================*/
+void FreqOpt_Enable(uint8_t en)
+{
+	if(!en && FreqOpt.Search)
+	{
+		FreqOpt.Search = 0;
+		Freq_Request(FreqOpt.BestPer);
+	}
+	FreqOpt.En = en;
+	FreqOpt.Bkt = 0xFF;
+	FreqOpt.Settle = 1;
+	FreqOpt.Cnt = 0;
+}
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Clear(void)
+**     Description : Forget the stored periods, every bucket is searched
+**                   again
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void FreqOpt_Clear(void)
+{
+	uint8_t i;
+
+	for(i = 0; i < FOPT_BUCKETS; i++)
+	{
+		FreqOpt.Tab[i].Per = 0;
+		FreqOpt.Tab[i].Eff = 0;
+	}
+	FreqOpt_Enable(FreqOpt.En);
+}
+
+/** ===================================================================
+**     Function Name : void FreqOpt_Task(void)
+**     Description : Scheduled every FOPT_PERIOD_MS, main loop context.
+**                   Idle unless enabled, closed loop and no fault.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void FreqOpt_Task(void)
+{
+	struct _SNAP snap;
+	int32_t pin, pout;
+	uint32_t bkt;
+
+	if(!FreqOpt.En || currentMode != MODE_CLOSE_LOOP || DF.ErrFlag != F_NOERR)
+	{
+		FreqOpt.Search = 0;
+		FreqOpt.Bkt = 0xFF;
+		FreqOpt.Settle = 1;
+		FreqOpt.Cnt = 0;
+		return;
+	}
+
+	Tele_Read(&snap);
+	if(FreqOpt.Settle)
+	{
+		if(++FreqOpt.Cnt < FOPT_SETTLE)
+			return;
+		FreqOpt.Settle = 0;
+		FreqOpt.Cnt = 0;
+		FreqOpt.PinSum = 0;
+		FreqOpt.PoutSum = 0;
+		FreqOpt.Per = snap.Perioid;
+		return;
+	}
+
+	FreqOpt.PinSum += snap.Adc.VinAvg * (snap.Adc.IinAvg - 2048) >> 11;
+	FreqOpt.PoutSum += snap.Adc.VoutAvg * (snap.Adc.IoutAvg - 2048) >> 11;
+	if(++FreqOpt.Cnt < FOPT_MEASURE)
+		return;
+
+	pin = FreqOpt.PinSum / FOPT_MEASURE;
+	pout = FreqOpt.PoutSum / FOPT_MEASURE;
+	FreqOpt.Cnt = 0;
+	FreqOpt.PinSum = 0;
+	FreqOpt.PoutSum = 0;
+	if(pin < FOPT_PIN_MIN)
+	{
+		FreqOpt.Search = 0;
+		FreqOpt.Bkt = 0xFF;
+		return;
+	}
+
+	FreqOpt.Eff = (uint16_t)((pout << 12) / pin);
+	bkt = (uint32_t)pout * FOPT_BUCKETS >> 12;
+	if(bkt >= FOPT_BUCKETS)
+		bkt = FOPT_BUCKETS - 1;
+
+	if(bkt != FreqOpt.Bkt)
+		FreqOpt_Load((uint8_t)bkt);
+	else if(FreqOpt.Search)
+		FreqOpt_Step();
+}
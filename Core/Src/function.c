@@ -82,6 +82,16 @@ TA1 and TB1 waveforms are complementary, TA2 and TB2 waveforms are complementary
 
 #include "function.h"
 #include "CtlLoop.h"
+#include "telemetry.h"
+#include "event.h"
+#include "boot.h"
+#include "interleave.h"
+#include "burst.h"
+#include "pcmc.h"
+#include "cal.h"
+#include "evlog.h"
+#include "filter.h"
+#include "sample.h"
 #include "stdio.h"
 #include "string.h"
 
@@ -97,16 +107,27 @@ uint16_t OLEDShowCnt = 0;
 #define MODE_OPEN 0
 #define MODE_CLOSE 1
 
-#define MODE_OPEN_LOOP 0
-#define MODE_CLOSE_LOOP 1
-
 volatile uint8_t currentMode = MODE_OPEN_LOOP;
+volatile uint8_t ModeReq = MODE_REQ_NONE;//mode requested by Mode_Switch(), taken over by the control ISR
+uint8_t CtlSat = 0;//CTL_SAT_xxx bits of the last control cycle (control ISR)
+uint32_t CtlSatCycles = 0;//control cycles with any loop saturated (control ISR)
+volatile int PerReq = 0;//period requested by Freq_Request(), 0 none
 
-// Minimum and maximum frequencies (unit: Hz)
-#define FreqMin 11200 // 70KHz
-#define FreqMax 20800 //130KHz
-#define FreqStepPercent 160 //1%
-//#define FreqStepPercent 16 //0.1%
+// Key table, indexed by KEY_ID (all keys are active low)
+static const struct
+{
+	GPIO_TypeDef *Port;
+	uint16_t Pin;
+} KeyTab[KEY_NUM] =
+{
+	{KEY1_INC_Freq_GPIO_Port, KEY1_INC_Freq_Pin},
+	{KEY2_DEC_Freq_GPIO_Port, KEY2_DEC_Freq_Pin},
+	{KEY3_INC_DT_GPIO_Port, KEY3_INC_DT_Pin},
+	{KEY4_DEC_DT_GPIO_Port, KEY4_DEC_DT_Pin},
+	{KEY5_INC_DUTY_GPIO_Port, KEY5_INC_DUTY_Pin},
+	{KEY6_DEC_DUTY_GPIO_Port, KEY6_DEC_DUTY_Pin},
+	{KEY7_SWITCH_MODE_GPIO_Port, KEY7_SWITCH_MODE_Pin},
+};
 
 // Dead time parameters (unit: 0.1%, i.e., adjust by 0.1% each step)
 #define DeadTimeStepPercent 160 //1%
@@ -134,117 +155,394 @@ volatile uint32_t currentPLLFreq = 160000000; // 160 MHz, based on fHRCK setting
 int gPerioid = 16000; //100KHz
 int gHalf = 8000; //50%
 int gDeadTime = 360; //2%
+volatile int gDtLeg[2] = {DT_LEG_DEF, DT_LEG_DEF}; //per leg dead time, HRTIM ticks, used with CTR_DT_LEG
+volatile uint32_t HrtimErrCnt = 0; //compare sets refused by Set_HRTIM_LegCompare(), see HRTIM_Apply()
 int gDuty = 7680; //48%
 
 
 /** ===================================================================
 **     Function Name : Button_Task
-**     Description : 
+**     Description : Apply the key events queued by Key_Sample()
+**       In closed loop the control ISR owns gDuty/gDeadTime, so only the
+**       mode key is served.
 **     Parameters  :
 **     Returns     :
 ** ===================================================================*/
 void Button_Task(void)
 {
-	// KEY1/PA6 : T1, TB1, TA2, TB2 simultaneously increase frequency
-	if (Key_Scan(KEY1_INC_Freq_GPIO_Port, KEY1_INC_Freq_Pin) == KEY_ON)
-	{
-		if(gPerioid < FreqMax)
-		{
-			if(gPerioid > FreqMax)
-				gPerioid = FreqMax;
+	struct _EVENT ev;
 
-			gPerioid += FreqStepPercent;
-			UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+	while (EvQ_Pop(&KeyEvQ, &ev))
+	{
+		if (currentMode == MODE_CLOSE_LOOP && ev.Arg != KEY_MODE)
+			continue;
 
-			DisplayFrequency(gPerioid);
+		switch (ev.Arg)
+		{
+		// KEY1/PA6 : T1, TB1, TA2, TB2 simultaneously increase frequency
+		case KEY_FREQ_INC:
+			if(gPerioid < FreqMax)
+			{
+				gPerioid += FreqStepPercent;
+				HRTIM_Apply();
+
+				DisplayFrequency(gPerioid);
+			}
+			break;
+
+		// KEY2/PA7 : T1, TB1, TA2, TB2 simultaneously decrease frequency
+		case KEY_FREQ_DEC:
+			if(gPerioid > FreqMin)
+			{
+				gPerioid -= FreqStepPercent;
+				HRTIM_Apply();
+
+				DisplayFrequency(gPerioid);
+			}
+			break;
+
+		// KEY3/PB4: Increase dead time of TA1/TB1
+		case KEY_DT_INC:
+			if (gDeadTime + DeadTimeStepPercent < gHalf)
+				gDeadTime += DeadTimeStepPercent;
+			HRTIM_Apply();
+			DisplayDeadTime(((float)gDeadTime) / 180.0f); // 360 / 180.0f = 2.0%
+			break;
+
+		// KEY4/PB5: Decrease dead time of TA1/TB1
+		case KEY_DT_DEC:
+			if (gDeadTime >= DeadTimeStepPercent)
+				gDeadTime -= DeadTimeStepPercent;
+			HRTIM_Apply();
+			DisplayDeadTime(((float)gDeadTime) / 180.0f); // 360 / 180.0f = 2.0%
+			break;
+
+		// KEY5/PB6: Simultaneously increase duty cycle of TA2/TB2
+		case KEY_DUTY_INC:
+			if (gDuty + DutyStepPercent < 16000)
+				gDuty += DutyStepPercent;
+			HRTIM_Apply();
+			DisplayDutyCycle(((float)gDuty / (float)gPerioid) * 100.0f); // 7680 /16000 *100 = 48.0%
+			break;
+
+		// KEY6/PB7: Simultaneously decrease duty cycle of TA2/TB2
+		case KEY_DUTY_DEC:
+			if (gDuty >= DutyStepPercent)
+				gDuty -= DutyStepPercent;
+			HRTIM_Apply();
+			DisplayDutyCycle(((float)gDuty / (float)gPerioid) * 100.0f); // 7680 /16000 *100 = 48.0%
+			break;
+
+		// KEY7/PB9: Request the other operating mode
+		case KEY_MODE:
+			ev.Type = EV_MODE;
+			ev.Arg = (currentMode == MODE_OPEN_LOOP) ? MODE_CLOSE_LOOP : MODE_OPEN_LOOP;
+			EvQ_Push(&AppEvQ, &ev);
+			break;
+
+		default:
+			break;
 		}
 	}
-	
-	// KEY2/PA7 : T1, TB1, TA2, TB2 simultaneously decrease frequency
-	if (Key_Scan(KEY2_DEC_Freq_GPIO_Port, KEY2_DEC_Freq_Pin) == KEY_ON)
-	{
-		if(gPerioid > FreqMin)
-		{
-			if(gPerioid < FreqMin)
-				gPerioid = FreqMin;
+}
 
-			gPerioid -= FreqStepPercent;
-			UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+/** ===================================================================
+**     Function Name : Event_Task
+**     Description : Handle fault, mode change and command events
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Event_Task(void)
+{
+	struct _EVENT ev;
+	struct _CMD_FRAME frame;
 
-			DisplayFrequency(gPerioid);
-		}
+	// Faults from the control ISR, the outputs are already disabled there
+	while (EvQ_Pop(&CtlEvQ, &ev))
+	{
+		if (ev.Type == EV_FAULT)
+			ShowModeLabel();
 	}
 
-	// KEY3/PB4: Increase dead time of TA1/TB1
-	if (Key_Scan(KEY3_INC_DT_GPIO_Port, KEY3_INC_DT_Pin) == KEY_ON)
+	// Command frames from USART2
+	while (EvQ_Pop(&CmdQ, &frame))
 	{
-		gDeadTime += DeadTimeStepPercent;
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+		Cmd_Process(&frame);
+	}
 
-		float deadTimePercent = ((float)gDeadTime) / 180.0f; // 360 / 180.0f = 2.0%
-		DisplayDeadTime(deadTimePercent);
+	// Mode changes requested by the mode key or a command, slow faults
+	// raised by Protect_Task()
+	while (EvQ_Pop(&AppEvQ, &ev))
+	{
+		if (ev.Type == EV_MODE && (ev.Arg != currentMode || DF.ErrFlag != F_NOERR))
+		{
+			Log_App(LOG_MODE, ev.Arg);
+			Mode_Switch(ev.Arg);
+		}
+		else if (ev.Type == EV_FAULT)
+			ShowModeLabel();
 	}
+}
+
+/** ===================================================================
+**     Function Name : Protect_Task
+**     Description : Protection housekeeping, runs every 10ms from the
+**       scheduler. Checks the slow input limits on the averaged values; the fast
+**       output limits stay in the control ISR. The input limits need a
+**       Vin divider (SAMP_CH_VIN, sample.h); the demo board has none,
+**       its PA0 is the set point potentiometer.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Protect_Task(void)
+{
+#if SAMP_HAS_VIN
+	VinSwUVP();
+	VinSwOVP();
+#endif
+	BBMode();
+}
 
-	// KEY4/PB5: Decrease dead time of TA1/TB1
-	if (Key_Scan(KEY4_DEC_DT_GPIO_Port, KEY4_DEC_DT_Pin) == KEY_ON)
+/** ===================================================================
+**     Function Name : BBMode
+**     Description : Select Buck/Boost/Mix from the voltage ratio
+**       Voref/VinAvg, with BB_HYST of hysteresis so the mode does not
+**       toggle at a boundary. The feedforward in VinFF() is only used
+**       in Buck, see VIN_FF_ON().
+**       Without a Vin sense (sample.h) the ratio is unknown and the
+**       stage stays Buck.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void BBMode(void)
+{
+	int32_t vin = SADC.VinAvg;
+	int32_t ratio;
+
+	if (!SAMP_HAS_VIN || (DF.CtrFlag & (CTR_PSFB | CTR_PCMC)))
 	{
-		gDeadTime -= DeadTimeStepPercent;
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
-		float deadTimePercent = ((float)gDeadTime) / 180.0f; // 360 / 180.0f = 2.0%
-		DisplayDeadTime(deadTimePercent);
+		DF.BBFlag = Buck;//no Vin; the full bridge is buck derived, PCMC acts on leg A only
+		return;
+	}
 
+	if (vin < VIN_FF_MIN)
+		vin = VIN_FF_MIN;
+	ratio = CtrValue.Voref * 4096 / vin;
+
+	switch (DF.BBFlag)
+	{
+	case Buck:
+		if (ratio > BB_BUCK_RATIO + BB_HYST)
+			DF.BBFlag = (ratio > BB_BOOST_RATIO) ? Boost : Mix;
+		break;
+	case Boost:
+		if (ratio < BB_BOOST_RATIO - BB_HYST)
+			DF.BBFlag = (ratio < BB_BUCK_RATIO) ? Buck : Mix;
+		break;
+	default://NA, Mix
+		if (ratio < BB_BUCK_RATIO - BB_HYST)
+			DF.BBFlag = Buck;
+		else if (ratio > BB_BOOST_RATIO + BB_HYST)
+			DF.BBFlag = Boost;
+		else
+			DF.BBFlag = Mix;
+		break;
 	}
+}
 
-	// KEY5/PB6: Simultaneously increase duty cycle of TA2/TB2
-	if (Key_Scan(KEY5_INC_DUTY_GPIO_Port, KEY5_INC_DUTY_Pin) == KEY_ON)
+/** ===================================================================
+**     Funtion Name :void Key_Sample(void)
+**     Description : Debounced key sampling, called from the TIM2 interrupt
+**       Keys are read every KEY_SAMPLE_DIV timer ticks. A key state is taken
+**       over when two consecutive samples agree, and a press pushes one
+**       EV_KEY event to KeyEvQ. Nothing blocks while a key is held.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Key_Sample(void)
+{
+	static uint8_t div = 0;
+	static uint8_t lastLevel = 0;//raw sample of the previous pass, bit per key
+	static uint8_t keyState = 0;//debounced state, bit per key
+	struct _EVENT ev;
+	uint8_t level = 0;
+	uint8_t i;
+
+	if (++div < KEY_SAMPLE_DIV)
+		return;
+	div = 0;
+
+	for (i = 0; i < KEY_NUM; i++)
 	{
-		gDuty += DutyStepPercent;
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
-		float dutyPercent = ((float)gDuty / (float)gPerioid) * 100.0f; // 7680 /16000 *100 = 48.0%
-		DisplayDutyCycle(dutyPercent);
+		if (HAL_GPIO_ReadPin(KeyTab[i].Port, KeyTab[i].Pin) == KEY_OFF)
+			level |= (uint8_t)(1u << i);
+	}
 
+	// Bits stable for two samples and different from the debounced state
+	i = (uint8_t)(~(level ^ lastLevel) & (level ^ keyState));
+	keyState ^= i;
+	lastLevel = level;
 
-	}
-	// KEY6/PB7: Simultaneously decrease duty cycle of TA2/TB2
-	if (Key_Scan(KEY6_DEC_DUTY_GPIO_Port, KEY6_DEC_DUTY_Pin) == KEY_ON)
+	ev.Type = EV_KEY;
+	ev.Val = 0;
+	for (ev.Arg = 0; ev.Arg < KEY_NUM; ev.Arg++)
 	{
-		gDuty -= DutyStepPercent;
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
-		float dutyPercent = ((float)gDuty / (float)gPerioid) * 100.0f; // 7680 /16000 *100 = 48.0%
-		DisplayDutyCycle(dutyPercent);
+		if (i & keyState & (1u << ev.Arg))
+			EvQ_Push(&KeyEvQ, &ev);
+	}
+}
+
+/** ===================================================================
+**     Funtion Name :void VoutSwOVP(void)
+**     Description : Output over-voltage protection, control ISR
+**       Vout above VOUT_OVP_VAL for OVP_CNT consecutive cycles disables
+**       all four outputs and raises an EV_FAULT event once.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void VoutSwOVP(void)
+{
+	static uint16_t OVPCnt = 0;
 
+	if (SADC.Vout > VOUT_OVP_VAL)
+	{
+		if (OVPCnt < OVP_CNT)
+			OVPCnt++;
+		else if ((DF.ErrFlag & F_SW_VOUT_OVP) == 0)
+			SwFault(F_SW_VOUT_OVP);
 	}
+	else
+		OVPCnt = 0;
+}
+
+/** ===================================================================
+**     Funtion Name :void SwOCP(void)
+**     Description : Output over-current protection, control ISR
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void SwOCP(void)
+{
+	static uint16_t OCPCnt = 0;
 
-	if (Key_Scan(KEY7_SWITCH_MODE_GPIO_Port, KEY7_SWITCH_MODE_Pin) == KEY_ON)
+	if (SADC.Iout > IOUT_OCP_VAL)
 	{
-		Mode_Switch(); // Switch mode
+		if (OCPCnt < OCP_CNT)
+			OCPCnt++;
+		else if ((DF.ErrFlag & F_SW_IOUT_OCP) == 0)
+			SwFault(F_SW_IOUT_OCP);
 	}
-	// Update OLED display
-		//UpdateDisplay();
-		UpdateDutyDisplay();
+	else
+		OCPCnt = 0;
+}
 
+#if SAMP_HAS_VIN
+/** ===================================================================
+**     Funtion Name :void VinSwUVP(void)
+**     Description : Input under-voltage protection, Protect_Task
+**       Only armed once VinAvg has been above VIN_UVP_VAL, so the
+**       converter can be powered up with the input still rising.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void VinSwUVP(void)
+{
+	static uint8_t armed = 0;
+	static uint16_t UVPCnt = 0;
+
+	if (SADC.VinAvg >= VIN_UVP_VAL)
+	{
+		armed = 1;
+		UVPCnt = 0;
+	}
+	else if (armed)
+	{
+		if (UVPCnt < VIN_PROT_CNT)
+			UVPCnt++;
+		else if ((DF.ErrFlag & F_SW_VIN_UVP) == 0)
+			SlowFault(F_SW_VIN_UVP);
+	}
 }
 
 /** ===================================================================
-**     Funtion Name :void Key_Scan(void)
-**     Description : The state of two buttons
-**       Default state of KEYFlag is 0. When pressed, Flag becomes 1, and when pressed again, Flag becomes 0, cycling in this way.
-**       When the machine is running normally or during startup, pressing the button will turn off the output and enter standby mode.
+**     Funtion Name :void VinSwOVP(void)
+**     Description : Input over-voltage protection, Protect_Task
 **     Parameters  :
 **     Returns     :
 ** ===================================================================*/
-uint8_t Key_Scan(GPIO_TypeDef* GPIOx,uint16_t GPIO_Pin)
-{			
-	/* Check if the button is pressed */
-	if(HAL_GPIO_ReadPin(GPIOx, GPIO_Pin) == KEY_OFF)  
-	{	 
-		/* Wait for the button to be released */
-		while(HAL_GPIO_ReadPin(GPIOx,GPIO_Pin) == KEY_OFF);   
-		return 	KEY_ON;	 
+void VinSwOVP(void)
+{
+	static uint16_t OVPCnt = 0;
+
+	if (SADC.VinAvg > VIN_OVP_VAL)
+	{
+		if (OVPCnt < VIN_PROT_CNT)
+			OVPCnt++;
+		else if ((DF.ErrFlag & F_SW_VIN_OVP) == 0)
+			SlowFault(F_SW_VIN_OVP);
 	}
 	else
-		return KEY_OFF;
+		OVPCnt = 0;
+}
+#endif
+
+/** ===================================================================
+**     Funtion Name :void FaultLatch(uint16_t err)
+**     Description : Disable the PWM outputs and latch the fault bit.
+**       ErrFlag is set with LDREX/STREX, so a fault raised by the
+**       control ISR in between is never lost.
+**     Parameters  : err - F_SW_xxx fault bit
+**     Returns     :
+** ===================================================================*/
+static CCMRAM void FaultLatch(uint16_t err)
+{
+	uint16_t flag;
+
+	HRTIM1->sCommonRegs.ODISR = HRTIM_OUTPUT_TA1 | HRTIM_OUTPUT_TA2 | HRTIM_OUTPUT_TB1 | HRTIM_OUTPUT_TB2;
+	do
+	{
+		flag = __LDREXH(&DF.ErrFlag);
+	} while (__STREXH((uint16_t)(flag | err), &DF.ErrFlag));
+}
+
+/** ===================================================================
+**     Funtion Name :void SwFault(uint16_t err)
+**     Description : Fault from the control ISR, tell the main loop
+**       through CtlEvQ and log it
+**     Parameters  : err - F_SW_xxx fault bit
+**     Returns     :
+** ===================================================================*/
+CCMRAM void SwFault(uint16_t err)
+{
+	struct _EVENT ev;
+
+	FaultLatch(err);
+
+	ev.Type = EV_FAULT;
+	ev.Arg = 0;
+	ev.Val = err;
+	EvQ_Push(&CtlEvQ, &ev);
+	Log_Isr(LOG_FAULT, err);
+}
+
+/** ===================================================================
+**     Funtion Name :void SlowFault(uint16_t err)
+**     Description : Fault from a main loop task, queued on AppEvQ
+**       (CtlEvQ only has the control ISR as producer)
+**     Parameters  : err - F_SW_xxx fault bit
+**     Returns     :
+** ===================================================================*/
+void SlowFault(uint16_t err)
+{
+	struct _EVENT ev;
+
+	FaultLatch(err);
 
+	ev.Type = EV_FAULT;
+	ev.Arg = 0;
+	ev.Val = err;
+	EvQ_Push(&AppEvQ, &ev);
+	Log_App(LOG_FAULT, err);
 }
 
 /*
@@ -256,20 +554,22 @@ uint8_t Key_Scan(GPIO_TypeDef* GPIOx,uint16_t GPIO_Pin)
 ** ===================================================================
 */
 struct _ADI SADC={2048,2048,0,0,2048,2048,0,0,0,0}; // Input and output parameter sampling values and average values
-struct _Ctr_value CtrValue={0,0,0,MIN_BUKC_DUTY,0,0,0}; // Control parameters
+struct _Ctr_value CtrValue={0,0,ILIMIT_DEF,MIN_BUKC_DUTY,0,0,0,0,PLIMIT_DEF,0,0}; // Control parameters
 struct _FLAG DF={0,0,0,0,0,0,0,0}; // Control flag bits
-uint16_t ADC1_RESULT[4]={0,0,0,0}; // DMA data storage register for transferring ADC samples from peripheral to memory
+uint16_t ADC1_RESULT[5]={0,0,0,0,0}; // Raw ADC samples of this cycle, gathered by Samp_Read()
 
 CCMRAM void ADCSample(void)
 {
-	// Declare variables for averaging Vin, Iin, Vout, and Iout
-	static uint32_t VinAvgSum=0, IinAvgSum=0, VoutAvgSum=0, IoutAvgSum=0;
-	
 	// Convert ADC readings using calibration factors (Q15 format), including offset compensation
-	SADC.Vin  = ((uint32_t)ADC1_RESULT[0] * CAL_VIN_K >> 12) + CAL_VIN_B;
-	SADC.Iin  = ((uint32_t)ADC1_RESULT[1] * CAL_IIN_K >> 12) + CAL_IIN_B;
-	SADC.Vout = ((uint32_t)ADC1_RESULT[2] * CAL_VOUT_K >> 12) + CAL_VOUT_B;
-	SADC.Iout = ((uint32_t)ADC1_RESULT[3] * CAL_IOUT_K >> 12) + CAL_IOUT_B;
+	// Per unit K/B from the RAM table, loaded from flash by Cal_Load()
+	// Vout/Iout come from the injected group converted at the end of
+	// the last period, Vin/Iin and the potentiometer from the
+	// oversampled regular scan (sample.c)
+	Samp_Read();
+	SADC.Vin  = ((int32_t)ADC1_RESULT[0] * Cal.K[CAL_VIN] >> 12) + Cal.B[CAL_VIN];
+	SADC.Iin  = ((int32_t)ADC1_RESULT[1] * Cal.K[CAL_IIN] >> 12) + Cal.B[CAL_IIN];
+	SADC.Vout = ((int32_t)ADC1_RESULT[2] * Cal.K[CAL_VOUT] >> 12) + Cal.B[CAL_VOUT];
+	SADC.Iout = ((int32_t)ADC1_RESULT[3] * Cal.K[CAL_IOUT] >> 12) + Cal.B[CAL_IOUT];
 
 	// Check for invalid readings; if Vin is below the threshold, set it to 0
 	if(SADC.Vin < 100) 
@@ -285,59 +585,283 @@ CCMRAM void ADCSample(void)
 	if(SADC.Iout < 2048)
 		SADC.Iout = 2048;
 
-	// Calculate average values of Vin, Iin, Vout, and Iout using moving average
-	VinAvgSum = VinAvgSum + SADC.Vin - (VinAvgSum >> 2); // Add current Vin value and subtract the oldest value
-	SADC.VinAvg = VinAvgSum >> 2; // Update Vin average
-	
-	IinAvgSum = IinAvgSum + SADC.Iin - (IinAvgSum >> 2); // Add current Iin value and subtract the oldest value
-	SADC.IinAvg = IinAvgSum >> 2; // Update Iin average
-	
-	VoutAvgSum = VoutAvgSum + SADC.Vout - (VoutAvgSum >> 2); // Add current Vout value and subtract the oldest value
-	SADC.VoutAvg = VoutAvgSum >> 2; // Update Vout average
-	
-	IoutAvgSum = IoutAvgSum + SADC.Iout - (IoutAvgSum >> 2); // Add current Iout value and subtract the oldest value
-	SADC.IoutAvg = IoutAvgSum >> 2; // Update Iout average
+	// Vout average every tick, Burst_Isr() gates on it; the other
+	// averages in ADCAverage(). Filter bank, see filter.c
+	SADC.VoutAvg = Filt_Run(&Filt[CAL_VOUT], SADC.Vout);
+
+	// Set point potentiometer, raw 12 bit, already oversampled
+	SADC.Vadj = ADC1_RESULT[SAMP_VADJ];
+}
+
+/*
+** ===================================================================
+**     Function Name :   void ADCAverage(void)
+**     Description :    Vin, Iin, Iout and potentiometer averages,
+**       control ISR every CTL_HK_DIV ticks. Only the main loop tasks
+**       read them (through the snapshot), so their filters run at the
+**       decimated rate and the time constants scale with CTL_HK_DIV.
+**     Parameters  :
+**     Returns     :
+** ===================================================================
+*/
+CCMRAM void ADCAverage(void)
+{
+	static uint32_t VadjAvgSum = 0;
+
+	SADC.VinAvg = Filt_Run(&Filt[CAL_VIN], SADC.Vin);
+	SADC.IinAvg = Filt_Run(&Filt[CAL_IIN], SADC.Iin);
+	SADC.IoutAvg = Filt_Run(&Filt[CAL_IOUT], SADC.Iout);
+
+	VadjAvgSum = VadjAvgSum + SADC.Vadj - (VadjAvgSum >> 2);
+	SADC.VadjAvg = VadjAvgSum >> 2;
+}
+
+/*
+** ===================================================================
+**     Function Name :   void PowerSample(void)
+**     Description :    Input/output power of this cycle and energy
+**       counters, control ISR right after ADCSample(). Each cycle adds
+**       P times its own length, so the energy stays right when the
+**       switching frequency is changed. A clear requested through
+**       PwrClrReq is done here, the counters have a single writer.
+**     Parameters  :
+**     Returns     :
+** ===================================================================
+*/
+struct _POWER SPWR={0,0,0,0}; // Power and energy
+volatile uint8_t PwrClrReq = 0; // Set by the main loop to clear the energy counters
+
+CCMRAM void PowerSample(void)
+{
+	SPWR.Pin = SADC.Vin * (SADC.Iin - 2048) >> 11;
+	SPWR.Pout = SADC.Vout * (SADC.Iout - 2048) >> 11;
+
+	if (PwrClrReq)
+	{
+		SPWR.EIn = 0;
+		SPWR.EOut = 0;
+		PwrClrReq = 0;
+	}
+	SPWR.EIn += (uint32_t)(SPWR.Pin * gPerioid);
+	SPWR.EOut += (uint32_t)(SPWR.Pout * gPerioid);
 }
 
 
 /**
   * @brief  Mode switch function
+  *         Only posts the request; the control ISR takes it over at its
+  *         next tick (Mode_Transfer), so the switch completes within one
+  *         switching period and the PWM is never re-initialised.
+  * @param  mode - MODE_OPEN_LOOP/MODE_CLOSE_LOOP; requesting the present
+  *         mode clears a latched fault
   * @retval None
   */
-void Mode_Switch(void)
+void Mode_Switch(uint8_t mode)
 {
-    if (currentMode == MODE_OPEN_LOOP)
-    {
-        currentMode = MODE_CLOSE_LOOP;
+    ModeReq = mode;
 
-		gPerioid = 16000;	//100KHz
-		gHalf = 8000;	//50%
-		gDeadTime = 360; //2%
-		gDuty = 7680; //48%
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+    HAL_GPIO_TogglePin(TEST_LED_GPIO_Port, TEST_LED_Pin); // Blink LED to indicate mode change
+}
 
-        // Display mode change
-        OLED_ShowStr(55, 0, "Close", 2);
+/** ===================================================================
+**     Funtion Name :void Mode_Transfer(void)
+**     Description : Bumpless open/closed loop transfer, control ISR
+**       Open -> close: the loop integrator is loaded with the duty that
+**       is applied now and the reference starts at the present Vout,
+**       then VrefGet() slews it to the set point. Without a Vout sense
+**       (SAMP_HAS_VOUT 0) the reference starts at the applied duty
+**       instead, see Ctl_Run().
+**       Close -> open: gDuty/gDeadTime already hold the last loop output
+**       and simply stay applied.
+**       A latched fault is cleared and the outputs are enabled again.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static CCMRAM void Mode_Transfer(void)
+{
+	uint8_t mode = ModeReq;
 
-		Close_Mode_Init();
-    }
-    else
-    {
-        currentMode = MODE_OPEN_LOOP;
+	if (mode == MODE_REQ_NONE)
+		return;
+	ModeReq = MODE_REQ_NONE;
 
-		gPerioid = 16000;	//100KHz
-		gHalf = 8000;	//50%
-		gDeadTime = 360; //2%
-		gDuty = 7680; //48%
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+	if (mode == MODE_CLOSE_LOOP)
+	{
+		CtrValue.BUCKMaxDuty = (DF.CtrFlag & CTR_PSFB) ? PSFB_MAX_DUTY : CLOSE_MAX_DUTY;
+		CtrValue.Voref = SAMP_HAS_VOUT ? SADC.VoutAvg : (gDuty << 13) / 16000;
+		BUCKVLoopInit(gDuty * 4096 / 16000);
+		DF.PWMENFlag = 1;
+	}
 
-        OLED_ShowStr(55, 0, "      ", 2); // Clear original display
-        OLED_ShowStr(55, 0, "Open", 2);   // Display mode change
+	if (DF.ErrFlag != F_NOERR)
+	{
+		DF.ErrFlag = F_NOERR;
+		HRTIM1->sCommonRegs.OENR = HRTIM_OUTPUT_TA1 | HRTIM_OUTPUT_TA2 | HRTIM_OUTPUT_TB1 | HRTIM_OUTPUT_TB2;
+	}
+	currentMode = mode;
+}
 
-		Open_Mode_Init();
-    }
+/** ===================================================================
+**     Funtion Name :void VrefGet(void)
+**     Description : Slew the voltage reference towards the set point,
+**       VREF_STEP per cycle. The set point is the potentiometer
+**       (VadjAvg), or CtrValue.VSet from CMD_SET_VREF/params with
+**       CTR_VSET_FIX; VSet is only written by the main loop.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void VrefGet(void)
+{
+	int32_t target = (DF.CtrFlag & CTR_VSET_FIX) ? CtrValue.VSet : SADC.VadjAvg;
 
-    HAL_GPIO_TogglePin(TEST_LED_GPIO_Port, TEST_LED_Pin); // Blink LED to indicate mode change
+	if (target > CtrValue.Voref + VREF_STEP)
+		CtrValue.Voref += VREF_STEP;
+	else if (target < CtrValue.Voref - VREF_STEP)
+		CtrValue.Voref -= VREF_STEP;
+	else
+		CtrValue.Voref = target;
+}
+
+/** ===================================================================
+**     Funtion Name :uint8_t Modulation_Set(uint8_t mod)
+**     Description : Select PWM, phase shifted full bridge or peak
+**       current mode modulation
+**       Only in open loop: they map the loop output to different
+**       volt-seconds, so a change in closed loop would step the output.
+**       Peak current mode is refused without the PB1 current sense
+**       (SAMP_FLAGS_NA).
+**     Parameters  : mod - MOD_PWM/MOD_PSFB/MOD_PCMC
+**     Returns     : 1 if taken over, 0 if refused
+** ===================================================================*/
+uint8_t Modulation_Set(uint8_t mod)
+{
+	if (currentMode != MODE_OPEN_LOOP || mod > MOD_PCMC)
+		return 0;
+	if (mod == MOD_PCMC && (SAMP_FLAGS_NA & CTR_PCMC))
+		return 0;
+
+	if (((DF.CtrFlag & CTR_PCMC) != 0) != (mod == MOD_PCMC))
+		Pcmc_Enable(mod == MOD_PCMC);
+	DF.CtrFlag &= ~(CTR_PSFB | CTR_PCMC);
+	if (mod == MOD_PSFB)
+		DF.CtrFlag |= CTR_PSFB;
+	else if (mod == MOD_PCMC)
+		DF.CtrFlag |= CTR_PCMC;
+	HRTIM_Apply();
+	return 1;
+}
+
+/** ===================================================================
+**     Funtion Name :void Freq_Request(int per)
+**     Description : Hand a new period to the control ISR, which owns
+**       gPerioid in closed loop; taken over at its next tick
+**     Parameters  : per - HRTIM period, FreqMin..FreqMax
+**     Returns     :
+** ===================================================================*/
+void Freq_Request(int per)
+{
+	if (per < FreqMin)
+		per = FreqMin;
+	if (per > FreqMax)
+		per = FreqMax;
+	PerReq = per;
+}
+
+/** ===================================================================
+**     Funtion Name :void Ctl_Run(void)
+**     Description : Mode handling and voltage loop, control ISR
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Ctl_Run(void)
+{
+	static uint16_t ff = 0;
+
+	Mode_Transfer();
+
+	CtlSat = 0;
+	if (currentMode != MODE_CLOSE_LOOP || DF.ErrFlag != F_NOERR)
+		return;
+
+	// Period from Freq_Request(), goes out with the duty of this cycle
+	if (PerReq != 0)
+	{
+		gPerioid = PerReq;
+		PerReq = 0;
+	}
+
+	// Burst mode idle slice: hold the loops and the duty until switching
+	// resumes, the integrators would wind up on the sagging Vout
+	if (Burst_Isr())
+		return;
+
+	// No Vout sense on this board (sample.h): closed loop maps the set
+	// point onto 0..50% duty as the original firmware did, a voltage
+	// loop on Vout = 0 would only wind up to BUCKMaxDuty
+	if (!SAMP_HAS_VOUT)
+	{
+		VrefGet();
+		gDuty = CtrValue.Voref * 16000 >> 13;
+		if ((DF.CtrFlag & CTR_PSFB) == 0)
+			gDeadTime = gHalf - gDuty;
+		HRTIM_Apply();
+		return;
+	}
+
+	// Feedforward switched on or off, by the flag or by leaving Buck:
+	// restart the loop from the present duty, the integrator holds a
+	// normalised duty only while it is on
+	if (VIN_FF_ON() != ff)
+	{
+		ff = VIN_FF_ON();
+		BUCKVLoopInit(CtrValue.BuckDuty);
+	}
+
+	VrefGet();
+	BUCKVLoopCtlPID();
+
+	// Saturation of the loop in control only, the others track it
+	if (CtlActive == CTL_LOOP_I)
+		CtlSat = ILoop.Sat << CTL_SAT_I_SHIFT;
+	else if (CtlActive == CTL_LOOP_P)
+		CtlSat = PLoop.Sat << CTL_SAT_P_SHIFT;
+	else if (CtlActive == CTL_LOOP_VIN)
+		CtlSat = VinLoop.Sat << CTL_SAT_VIN_SHIFT;
+	else
+		CtlSat = VLoop.Sat << CTL_SAT_V_SHIFT;
+	if (CtlSat)
+		CtlSatCycles++;
+
+	// Peak current mode: the loop output is the current threshold, the
+	// duty compare only bounds the on time
+	if (DF.CtrFlag & CTR_PCMC)
+	{
+		Pcmc_SetRef(CtrValue.BuckDuty);
+		gDuty = CtrValue.BUCKMaxDuty * 16000 >> 12;
+	}
+	else
+		gDuty = CtrValue.BuckDuty * 16000 >> 12;
+	if ((DF.CtrFlag & CTR_PSFB) == 0)
+		gDeadTime = gHalf - gDuty;
+	HRTIM_Apply();
+}
+
+/** ===================================================================
+**     Funtion Name :void ShowModeLabel(void)
+**     Description : Repaint the mode field only when it changed
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void ShowModeLabel(void)
+{
+	static const char *Label[] = {"Open ", "Close", "Err  "};
+	static uint8_t shown = 0xFF;
+	uint8_t label = (DF.ErrFlag != F_NOERR) ? 2 : currentMode;
+
+	if (!BOOT_READY(BOOT_DISPLAY) || label == shown)
+		return;
+	shown = label;
+	OLED_ShowStr(55, 0, (unsigned char *)Label[label], 2);
 }
 
 
@@ -347,48 +871,36 @@ void Mode_Switch(void)
   */
 void UpdateDutyDisplay(void)
 {
-    if (currentMode == MODE_CLOSE_LOOP)
-    {
-        // 1. Start ADC sampling and use DMA to transfer data
-        HAL_ADC_Start_DMA(&hadc1, (uint32_t*)ADC1_RESULT, 4);
-        HAL_ADC_Start(&hadc1);
-
-        // 2. Sample ADC data
-        ADCSample();
-
-        // 3. Convert ADC value to voltage (0-3.3V)
-        float adc_voltage = (SADC.VinAvg / 4095.0f) * 3.3f;
+    struct _SNAP snap;
 
-        // 4. Map ADC voltage to 0-50% duty cycle range
-        float duty_percent = (adc_voltage / 3.3f) * 50.0f;
+    if (!BOOT_READY(BOOT_DISPLAY))
+        return;
 
-        // 5. Limit duty cycle to 0-50%
-        if (duty_percent < 0.0f)
-            duty_percent = 0.0f;
-        if (duty_percent > 50.0f)
-            duty_percent = 50.0f;
+    ShowModeLabel();
 
-        // 6. Update global duty cycle value gDuty
-        // gDuty = (duty percentage / 100) * period value
-        gDuty = (int)((duty_percent / 100.0f) * gPerioid);
+    if (currentMode == MODE_CLOSE_LOOP)
+    {
+        // 1. ADC1 converts on its own (sample.c), the duty is set by
+        // the voltage loop in the control ISR
 
-		gDeadTime = gHalf - gDuty;
+        // 2. Take a consistent copy of the values sampled by the control ISR
+        Tele_Read(&snap);
 
-		// 7. Call UpdateHRTIM function to update PWM configuration
-		UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+        // 3. Duty applied by the loop, 16000 = 100%
+        float duty_percent = (float)snap.Duty / 160.0f;
 
-        // 8. Display frequency
+        // 4. Display frequency
         // Calculate frequency based on gPerioid and display
-        DisplayFrequency(gPerioid);
+        DisplayFrequency(snap.Perioid);
 
-        // 9. Display ADC voltage
+        // 5. Display ADC voltage
         // Display in mV and show
-        float adc_voltage_display = (SADC.VinAvg / 4095.0f) * 3.3f;
+        float adc_voltage_display = (snap.Adc.VadjAvg / 4095.0f) * 3.3f;
         unsigned char adcStr[10];
         sprintf((char*)adcStr, "%.3f ", adc_voltage_display); // For example, "1.650V"
         OLED_ShowStr(50, 6, adcStr, 2); // Display at position (50,6)
 
-        // 10. Display duty cycle
+        // 6. Display duty cycle
         // Use existing DisplayDutyCycle function to display duty cycle
         DisplayDutyCycle(duty_percent);
 
@@ -410,115 +922,60 @@ void UpdateDutyDisplay(void)
 
 
 /** ===================================================================
-**     Function Name : void MX_OLED_Init(void)
-**     Description : OLED initialization routine
-**     Initialize the OLED display interface
-**     Parameters  :
-**     Returns     :
-** ===================================================================*/
-void Close_Mode_Init(void)
-{
-	currentMode = MODE_CLOSE_LOOP;
-
-	// Initialize the OLED
-	OLED_Init();
-	OLED_CLS(); // Clear the OLED display
-	
-	// Display default frequency 100KHz
-	gPerioid = 16000;
-	DisplayFrequency(gPerioid);
-
-	// Display initial text labels on the OLED
-	OLED_ShowStr(0, 0, "Mode:", 2);
-	OLED_ShowStr(55, 0, "Close", 2);   // Display mode change
-
-	OLED_ShowStr(0, 2, "Freq:", 2);
-	OLED_ShowStr(68, 2, ".", 2);
-	OLED_ShowStr(100, 2, "KHz", 2);
-
-	OLED_ShowStr(0, 4, "Du/DT:", 2);
-	OLED_ShowStr(85, 4, "/", 2);
-	OLED_ShowStr(120, 4, "%", 2);
-
-	// Display dead time
-	gCurrentDeadTimePercent = 2;
-	DisplayDeadTime((float)gCurrentDeadTimePercent);
-
-
-	// Display duty cycle
-	gCurrentDutyPercent_TA2_TB2 = 48;
-	DisplayDutyCycle(gCurrentDutyPercent_TA2_TB2);
-
-
-	OLED_ShowStr(0, 6, "ADC:", 2);
-	OLED_ShowStr(60, 6, ".", 2);
-	OLED_ShowStr(98, 6, "V", 2);
-
-	// Display ADC voltage
-	uint8_t Vtemp[4] = {0};
-	OLEDShowData(50, 6, Vtemp[0]);
-	OLEDShowData(65, 6, Vtemp[1]);
-	OLEDShowData(75, 6, Vtemp[2]);
-	OLEDShowData(85, 6, Vtemp[3]);
-
-
-	OLED_ON(); // Turn on the OLED display
-}
-
-/** ===================================================================
-**     Function Name : void MX_OLED_Init(void)
-**     Description : OLED initialization routine
-**     Initialize the OLED display interface
-**     Parameters  :
+**     Function Name : void Display_Layout(uint8_t row)
+**     Description : Paint one text row of the fixed screen layout
+**       Called row by row from the boot sequence so that no single
+**       scheduler pass blocks on the whole screen. The mode field is
+**       left to ShowModeLabel().
+**     Parameters  : row - 0..DISPLAY_ROWS-1
 **     Returns     :
 ** ===================================================================*/
-void Open_Mode_Init(void)
+void Display_Layout(uint8_t row)
 {
-	currentMode = MODE_OPEN_LOOP;
-
-	// Initialize the OLED
-	OLED_Init();
-	OLED_CLS(); // Clear the OLED display
-	
-	// Display default frequency 100KHz
-	gPerioid = 16000;
-	DisplayFrequency(gPerioid);
-
-	// Display initial text labels on the OLED
-	OLED_ShowStr(0, 0, "Mode:", 2);
-	OLED_ShowStr(55, 0, "Open", 2);   // Display mode change
-
-	OLED_ShowStr(0, 2, "Freq:", 2);
-	OLED_ShowStr(68, 2, ".", 2);
-	OLED_ShowStr(100, 2, "KHz", 2);
-
-	OLED_ShowStr(0, 4, "Du/DT:", 2);
-	OLED_ShowStr(85, 4, "/", 2);
-	OLED_ShowStr(120, 4, "%", 2);
-
-	// Display dead time
-	gCurrentDeadTimePercent = 2;
-	DisplayDeadTime((float)gCurrentDeadTimePercent);
-
-
-	// Display duty cycle
-	gCurrentDutyPercent_TA2_TB2 = 48;
-	DisplayDutyCycle(gCurrentDutyPercent_TA2_TB2);
-
-
-	OLED_ShowStr(0, 6, "ADC:", 2);
-	OLED_ShowStr(60, 6, ".", 2);
-	OLED_ShowStr(98, 6, "V", 2);
-
-	// Display ADC voltage
 	uint8_t Vtemp[4] = {0};
-	OLEDShowData(50, 6, Vtemp[0]);
-	OLEDShowData(65, 6, Vtemp[1]);
-	OLEDShowData(75, 6, Vtemp[2]);
-	OLEDShowData(85, 6, Vtemp[3]);
 
-
-	OLED_ON(); // Turn on the OLED display
+	switch (row)
+	{
+	case 0:
+		OLED_ShowStr(0, 0, "Mode:", 2);
+		break;
+
+	case 1:
+		DisplayFrequency(gPerioid);
+		OLED_ShowStr(0, 2, "Freq:", 2);
+		OLED_ShowStr(68, 2, ".", 2);
+		OLED_ShowStr(100, 2, "KHz", 2);
+		break;
+
+	case 2:
+		OLED_ShowStr(0, 4, "Du/DT:", 2);
+		OLED_ShowStr(85, 4, "/", 2);
+		OLED_ShowStr(120, 4, "%", 2);
+
+		// Display dead time
+		gCurrentDeadTimePercent = 2;
+		DisplayDeadTime((float)gCurrentDeadTimePercent);
+
+		// Display duty cycle
+		gCurrentDutyPercent_TA2_TB2 = 48;
+		DisplayDutyCycle(gCurrentDutyPercent_TA2_TB2);
+		break;
+
+	case 3:
+		OLED_ShowStr(0, 6, "ADC:", 2);
+		OLED_ShowStr(60, 6, ".", 2);
+		OLED_ShowStr(98, 6, "V", 2);
+
+		// Display ADC voltage
+		OLEDShowData(50, 6, Vtemp[0]);
+		OLEDShowData(65, 6, Vtemp[1]);
+		OLEDShowData(75, 6, Vtemp[2]);
+		OLEDShowData(85, 6, Vtemp[3]);
+		break;
+
+	default:
+		break;
+	}
 }
 
 
@@ -597,6 +1054,10 @@ void DisplayDeadTime(float dead_time_percent)
 
 
 
+// Dead time defaults must fit the 9 bit DTR/DTF fields and respect the minimum
+typedef char DtgRangeCheck[(DTG_NS(DT_RISE_NS) <= DTG_MAX && DTG_NS(DT_FALL_NS) <= DTG_MAX
+	&& DT_RISE_NS >= DT_HW_MIN_NS && DT_FALL_NS >= DT_HW_MIN_NS && DTG_NS(DT_HW_MIN_NS) > 0) ? 1 : -1];
+
 /**
   * @brief  Update the PWM frequency of HRTIM
   * @param  period: Timer period
@@ -657,10 +1118,10 @@ void UpdateHRTIM(int period, int half_period, int duty_cycle, int dead_time)
     timerConfig.StartOnSync = HRTIM_SYNCSTART_DISABLED;    // Disable synchronous start
     timerConfig.ResetOnSync = HRTIM_SYNCRESET_DISABLED;    // Disable synchronous reset
     timerConfig.DACSynchro = HRTIM_DACSYNC_NONE;           // Disable DAC synchronization
-    timerConfig.PreloadEnable = HRTIM_PRELOAD_DISABLED;    // Disable preload
+    timerConfig.PreloadEnable = HRTIM_PRELOAD_ENABLED;     // Preload, runtime writes take effect at the period boundary
     timerConfig.UpdateGating = HRTIM_UPDATEGATING_INDEPENDENT; // Set update gating to independent
     timerConfig.BurstMode = HRTIM_TIMERBURSTMODE_MAINTAINCLOCK; // Set burst mode to maintain clock
-    timerConfig.RepetitionUpdate = HRTIM_UPDATEONREPETITION_DISABLED; // Disable repetition update
+    timerConfig.RepetitionUpdate = HRTIM_UPDATEONREPETITION_ENABLED; // Master update on every period (repetition counter 0)
     timerConfig.ReSyncUpdate = HRTIM_TIMERESYNC_UPDATE_UNCONDITIONAL; // Set resync update to unconditional
 
     // Apply the control configuration to the MASTER timer, call error handler if configuration fails
@@ -698,11 +1159,16 @@ void UpdateHRTIM(int period, int half_period, int duty_cycle, int dead_time)
     timerConfig.PushPull = HRTIM_TIMPUSHPULLMODE_DISABLED; // Disable push-pull mode
     timerConfig.FaultEnable = HRTIM_TIMFAULTENABLE_NONE;    // Disable faults
     timerConfig.FaultLock = HRTIM_TIMFAULTLOCK_READWRITE;   // Set fault lock to read/write
+#if HRTIM_HW_DEADTIME
+    timerConfig.DeadTimeInsertion = HRTIM_TIMDEADTIMEINSERTION_ENABLED; // Tx2 = complement of Tx1 through the dead time unit
+#else
     timerConfig.DeadTimeInsertion = HRTIM_TIMDEADTIMEINSERTION_DISABLED; // Disable dead time insertion
+#endif
     timerConfig.DelayedProtectionMode = HRTIM_TIMER_A_B_C_DELAYEDPROTECTION_DISABLED; // Disable delayed protection mode
     timerConfig.UpdateTrigger = HRTIM_TIMUPDATETRIGGER_NONE; // Disable update trigger
     timerConfig.ResetTrigger = HRTIM_TIMRESETTRIGGER_MASTER_PER; // Set reset trigger source to MASTER timer period
-    timerConfig.ResetUpdate = HRTIM_TIMUPDATEONRESET_DISABLED; // Disable update on reset
+    timerConfig.RepetitionUpdate = HRTIM_UPDATEONREPETITION_DISABLED; // Disable repetition update
+    timerConfig.ResetUpdate = HRTIM_TIMUPDATEONRESET_ENABLED; // Update when the timer is reset, i.e. at the start of its own cycle
 
     // Apply Timer A's compare unit configuration, call error handler if configuration fails
     if (HAL_HRTIM_WaveformTimerConfig(&hhrtim1, HRTIM_TIMERINDEX_TIMER_A, &timerConfig) != HAL_OK)
@@ -738,8 +1204,12 @@ void UpdateHRTIM(int period, int half_period, int duty_cycle, int dead_time)
     // Configure TA1 and TB1's output parameters
     outputConfig.Polarity = HRTIM_OUTPUTPOLARITY_HIGH; // Set output polarity to high
     outputConfig.SetSource = HRTIM_OUTPUTSET_TIMPER;    // Set output set source to MASTER timer period
+#if HRTIM_HW_DEADTIME
+    outputConfig.ResetSource = HRTIM_OUTPUTRESET_TIMCMP2; // Tx1 carries the duty, Tx2 follows from the dead time unit
+#else
     outputConfig.ResetSource = HRTIM_OUTPUTRESET_TIMCMP1; // Set output reset source to compare unit 1
-    outputConfig.IdleMode = HRTIM_OUTPUTIDLEMODE_NONE; // Set idle mode to none
+#endif
+    outputConfig.IdleMode = HRTIM_OUTPUTIDLEMODE_IDLE; // Outputs follow the burst mode controller, see burst.c
     outputConfig.IdleLevel = HRTIM_OUTPUTIDLELEVEL_INACTIVE; // Set idle level to inactive
     outputConfig.FaultLevel = HRTIM_OUTPUTFAULTLEVEL_NONE; // Set fault level to none
     outputConfig.ChopperModeEnable = HRTIM_OUTPUTCHOPPERMODE_DISABLED; // Disable chopper mode
@@ -793,6 +1263,32 @@ void UpdateHRTIM(int period, int half_period, int duty_cycle, int dead_time)
     }
 
     /* USER CODE BEGIN HRTIM1_Init 2 */
+#if HRTIM_HW_DEADTIME
+    {
+        HRTIM_DeadTimeCfgTypeDef deadTimeConfig = {0};
+
+        deadTimeConfig.Prescaler = HRTIM_DTG_PRSC << HRTIM_DTR_DTPRSC_Pos;
+        deadTimeConfig.RisingValue = DTG_NS(DT_RISE_NS);
+        deadTimeConfig.RisingSign = HRTIM_TIMDEADTIME_RISINGSIGN_POSITIVE;
+        deadTimeConfig.RisingLock = HRTIM_TIMDEADTIME_RISINGLOCK_WRITE;
+        deadTimeConfig.RisingSignLock = HRTIM_TIMDEADTIME_RISINGSIGNLOCK_READONLY; // a negative dead time would overlap
+        deadTimeConfig.FallingValue = DTG_NS(DT_FALL_NS);
+        deadTimeConfig.FallingSign = HRTIM_TIMDEADTIME_FALLINGSIGN_POSITIVE;
+        deadTimeConfig.FallingLock = HRTIM_TIMDEADTIME_FALLINGLOCK_WRITE;
+        deadTimeConfig.FallingSignLock = HRTIM_TIMDEADTIME_FALLINGSIGNLOCK_READONLY;
+        if (HAL_HRTIM_DeadTimeConfig(&hhrtim1, HRTIM_TIMERINDEX_TIMER_A, &deadTimeConfig) != HAL_OK)
+        {
+            Error_Handler();
+        }
+        if (HAL_HRTIM_DeadTimeConfig(&hhrtim1, HRTIM_TIMERINDEX_TIMER_B, &deadTimeConfig) != HAL_OK)
+        {
+            Error_Handler();
+        }
+    }
+#endif
+    // Preload is on: move the values written above to the active registers now
+    HAL_HRTIM_SoftwareUpdate(&hhrtim1, HRTIM_TIMERUPDATE_MASTER | HRTIM_TIMERUPDATE_A | HRTIM_TIMERUPDATE_B);
+
     // Store global time base configuration
     pGlobalTimeBaseCfg = timeBaseConfig;
 
@@ -805,6 +1301,183 @@ void UpdateHRTIM(int period, int half_period, int duty_cycle, int dead_time)
     HAL_HRTIM_MspPostInit(&hhrtim1);
 }
 
+// Compare value kept inside the period, see HRTIM_Apply()
+static CCMRAM int32_t HRTIM_CmpClamp(int32_t cmp, int32_t per)
+{
+	if (cmp > per - HRTIM_CMP_MIN)
+		cmp = per - HRTIM_CMP_MIN;
+	if (cmp < HRTIM_CMP_MIN)
+		cmp = HRTIM_CMP_MIN;
+	return cmp;
+}
+
+/** ===================================================================
+**     Function Name : HRTIM_Apply
+**     Description : Write gPerioid/gHalf/gDuty/gDeadTime to the running
+**       HRTIM, same scaling as UpdateHRTIM()
+**       With CTR_DT_LEG set each leg gets its own gap between the
+**       TAx2/TBx2 and TAx1/TBx1 resets, gDtLeg[] in HRTIM ticks, never
+**       below DT_MIN_TICKS. CMP2 is raised if needed so that the gap
+**       survives the HRTIM_CMP_MIN clamp of CMP1.
+**       With HRTIM_HW_DEADTIME the gap is made by the dead time units
+**       instead, see HRTIM_SetDeadTime().
+**       With CTR_PSFB set the legs run at 50% and gDuty sets the phase
+**       of leg B (master CMP1): effective duty = 2 x phase / period.
+**       Compare values are kept inside HRTIM_CMP_MIN..period -
+**       HRTIM_CMP_MIN, so a dead time larger than the half period does
+**       not wrap; a set still refused is counted in HrtimErrCnt.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void HRTIM_Apply(void)
+{
+	int32_t d2 = gDuty * gPerioid / 16000;
+	int32_t t2 = gHalf * gPerioid / 16000;
+	int32_t dt[2];
+	uint32_t cr1;
+	HAL_StatusTypeDef status;
+	uint8_t i;
+
+	// Phase shift: both legs at 50%, gDuty moves leg B instead
+	if (DF.CtrFlag & CTR_PSFB)
+	{
+		t2 = gDuty * gPerioid / 32000;
+		d2 = gHalf * gPerioid / 16000;
+	}
+
+	// Interleaved phases follow phase 0 and take their values at the
+	// same update as Timer A/B
+	cr1 = HRTIM1->sCommonRegs.CR1;
+	HRTIM1->sCommonRegs.CR1 = cr1 | HRTIM_CR1_MUDIS | INTLV_UDIS;
+	Intlv_Apply(d2, gPerioid);
+	Samp_Apply(gPerioid);
+
+#if HRTIM_HW_DEADTIME
+	// Dead time comes from the dead time units, CMP1 is not used by the
+	// outputs; per leg values go to the rising edge of each unit
+	for (i = 0; i < 2; i++)
+	{
+		dt[i] = (DF.CtrFlag & CTR_DT_LEG) ? DTG_TICKS(gDtLeg[i]) : DTG_NS(DT_RISE_NS);
+		HRTIM_SetDeadTime(i, dt[i], DTG_NS(DT_FALL_NS));
+	}
+	d2 = HRTIM_CmpClamp(d2, gPerioid);
+	t2 = HRTIM_CmpClamp(t2, gPerioid);
+	status = Set_HRTIM_CompareValue(d2, d2, gPerioid, t2);
+#else
+	d2 = HRTIM_CmpClamp(d2, gPerioid);
+	t2 = HRTIM_CmpClamp(t2, gPerioid);
+	if ((DF.CtrFlag & CTR_DT_LEG) == 0)
+	{
+		status = Set_HRTIM_CompareValue(HRTIM_CmpClamp(gHalf * gPerioid / 16000 - gDeadTime, gPerioid), d2, gPerioid, t2);
+	}
+	else
+	{
+		for (i = 0; i < 2; i++)
+		{
+			dt[i] = gDtLeg[i];
+			if (dt[i] < DT_MIN_TICKS)
+				dt[i] = DT_MIN_TICKS;
+			if (d2 < HRTIM_CMP_MIN + dt[i])
+				d2 = HRTIM_CMP_MIN + dt[i];
+		}
+		status = Set_HRTIM_LegCompare(d2 - dt[0], d2 - dt[1], d2, gPerioid, t2);
+	}
+#endif
+	HRTIM1->sCommonRegs.CR1 = cr1;
+	if (status != HAL_OK)
+		HrtimErrCnt++;//nothing written, the previous timing stays
+}
+
+/** ===================================================================
+**     Function Name : Set_HRTIM_CompareValue
+**     Description : Write new timing straight into the running HRTIM,
+**       without the HAL re-init and DLL calibration of UpdateHRTIM()
+**       The registers are preloaded: the master and Timer A take the
+**       new values at the master period, Timer B at its reset (master
+**       CMP1), so a period never mixes old and new values. The update
+**       disable bits are held while writing, so a transfer cannot
+**       split the set either. Called from one context at a time: the
+**       main loop in open loop, the control ISR in closed loop.
+**     Parameters  : D1 - Timer A/B CMP1, TA1/TB1 reset
+**                   D2 - Timer A/B CMP2, TA2/TB2 reset
+**                   T1 - period of master, Timer A and Timer B
+**                   T2 - master CMP1, Timer B reset (phase of leg B)
+**       Compare values below HRTIM_CMP_MIN are raised to it.
+**     Returns     : HAL_ERROR if a value does not fit the period
+** ===================================================================*/
+HAL_StatusTypeDef Set_HRTIM_CompareValue(uint32_t D1,uint32_t D2,uint32_t T1,uint32_t T2)
+{
+	return Set_HRTIM_LegCompare(D1, D1, D2, T1, T2);
+}
+
+/** ===================================================================
+**     Function Name : HRTIM_SetDeadTime
+**     Description : Rising/falling dead time of one leg's dead time
+**       unit, HRTIM_HW_DEADTIME only. The DTxR register is not
+**       preloaded; the write is skipped when nothing changes, so the
+**       control ISR can call this every cycle. Values are clamped to
+**       DT_HW_MIN_NS..DTG_MAX.
+**     Parameters  : leg - 0 Timer A, 1 Timer B
+**                   rise, fall - dead time in DTG ticks, see DTG_NS()
+**     Returns     :
+** ===================================================================*/
+CCMRAM void HRTIM_SetDeadTime(uint8_t leg, uint32_t rise, uint32_t fall)
+{
+	uint32_t dtr, old;
+
+	if (rise < DTG_NS(DT_HW_MIN_NS))
+		rise = DTG_NS(DT_HW_MIN_NS);
+	if (fall < DTG_NS(DT_HW_MIN_NS))
+		fall = DTG_NS(DT_HW_MIN_NS);
+	if (rise > DTG_MAX)
+		rise = DTG_MAX;
+	if (fall > DTG_MAX)
+		fall = DTG_MAX;
+
+	old = HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A + leg].DTxR;
+	dtr = (old & ~(HRTIM_DTR_DTR_Msk | HRTIM_DTR_DTF_Msk))
+		| (rise << HRTIM_DTR_DTR_Pos) | (fall << HRTIM_DTR_DTF_Pos);
+	if (dtr != old)
+		HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A + leg].DTxR = dtr;
+}
+
+/** ===================================================================
+**     Function Name : Set_HRTIM_LegCompare
+**     Description : As Set_HRTIM_CompareValue(), with a CMP1 per leg
+**     Parameters  : D1A - Timer A CMP1, D1B - Timer B CMP1, others as
+**                   Set_HRTIM_CompareValue()
+**     Returns     : HAL_ERROR if a value does not fit the period
+** ===================================================================*/
+HAL_StatusTypeDef Set_HRTIM_LegCompare(uint32_t D1A,uint32_t D1B,uint32_t D2,uint32_t T1,uint32_t T2)
+{
+	uint32_t D1[2];
+	uint32_t cr1;
+	uint8_t i;
+
+	if (T1 > HRTIM_PER_MAX || D1A >= T1 || D1B >= T1 || D2 >= T1 || T2 >= T1)
+		return HAL_ERROR;
+
+	D1[0] = (D1A < HRTIM_CMP_MIN) ? HRTIM_CMP_MIN : D1A;
+	D1[1] = (D1B < HRTIM_CMP_MIN) ? HRTIM_CMP_MIN : D1B;
+	if (D2 < HRTIM_CMP_MIN)
+		D2 = HRTIM_CMP_MIN;
+	if (T2 < HRTIM_CMP_MIN)
+		T2 = HRTIM_CMP_MIN;
+
+	cr1 = HRTIM1->sCommonRegs.CR1;//restored below, HRTIM_Apply() may hold more bits
+	HRTIM1->sCommonRegs.CR1 = cr1 | HRTIM_CR1_MUDIS | HRTIM_CR1_TAUDIS | HRTIM_CR1_TBUDIS;
+	HRTIM1->sMasterRegs.MPER = T1;
+	HRTIM1->sMasterRegs.MCMP1R = T2;
+	for (i = HRTIM_TIMERINDEX_TIMER_A; i <= HRTIM_TIMERINDEX_TIMER_B; i++)
+	{
+		HRTIM1->sTimerxRegs[i].PERxR = T1;
+		HRTIM1->sTimerxRegs[i].CMP1xR = D1[i - HRTIM_TIMERINDEX_TIMER_A];
+		HRTIM1->sTimerxRegs[i].CMP2xR = D2;
+	}
+	HRTIM1->sCommonRegs.CR1 = cr1;
+	return HAL_OK;
+}
+
 
 
 
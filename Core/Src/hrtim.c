@@ -198,6 +198,9 @@ void HAL_HRTIM_MspInit(HRTIM_HandleTypeDef* hrtimHandle)
     /* HRTIM1 clock enable */
     __HAL_RCC_HRTIM1_CLK_ENABLE();
   /* USER CODE BEGIN HRTIM1_MspInit 1 */
+    /* HRTIM1 timer A interrupt Init (control tick) */
+    HAL_NVIC_SetPriority(HRTIM1_TIMA_IRQn, PRIO_CTL_ISR, 0);
+    HAL_NVIC_EnableIRQ(HRTIM1_TIMA_IRQn);
 
   /* USER CODE END HRTIM1_MspInit 1 */
   }
@@ -245,6 +248,7 @@ void HAL_HRTIM_MspDeInit(HRTIM_HandleTypeDef* hrtimHandle)
     /* Peripheral clock disable */
     __HAL_RCC_HRTIM1_CLK_DISABLE();
   /* USER CODE BEGIN HRTIM1_MspDeInit 1 */
+    HAL_NVIC_DisableIRQ(HRTIM1_TIMA_IRQn);
 
   /* USER CODE END HRTIM1_MspDeInit 1 */
   }
@@ -0,0 +1,341 @@
+/** ===================================================================
+**     File Name   : interleave.c
+**     Description : N-phase interleaving on the spare HRTIM timers
+**
+**     Phase k (k = 1..Active-1) runs on Timer C/D/F with the same
+**     period as Timer A and is reset by master CMP(k+1) placed at
+**     k x period / Active, so the phases are spread over 360 degrees.
+**     All phases get the duty of phase 0 plus a per phase trim. The
+**     control ISR writes them through Intlv_Apply() from HRTIM_Apply(),
+**     inside the same update disable bracket as Timer A/B.
+**
+**     Intlv_Task (main loop):
+**       Balancing: ADC2 converts the phase currents as an injected
+**       sequence, started on one pass and read on the next. The trim of
+**       each phase k > 0 integrates the difference to the mean, so
+**       phase 0 stays the reference of the loop.
+**       Shedding: with Shed set the number of phases follows the net
+**       output current, one phase per INTLV_I_PHASE with INTLV_I_HYST
+**       hysteresis. The highest phase is switched off first and the
+**       remaining ones are spread again.
+** ===================================================================*/
+
+#include "interleave.h"
+#include "hrtim.h"
+#include "telemetry.h"
+
+struct _INTLV Intlv = {1, 0};
+
+#if INTLV_PHASES > 1
+
+typedef char IntlvPhaseCheck[(INTLV_PHASES <= INTLV_PHASES_MAX) ? 1 : -1];
+
+extern HRTIM_TimeBaseCfgTypeDef pGlobalTimeBaseCfg;
+
+static ADC_HandleTypeDef hadc2;
+
+//Timer, master reset compare, output and ADC2 channel of each phase > 0
+static const struct
+{
+	uint8_t		Timer;//HRTIM_TIMERINDEX_xxx
+	uint32_t	Reset;//HRTIM_TIMRESETTRIGGER_MASTER_CMPx
+	uint32_t	Output;//HRTIM_OUTPUT_Tx1
+	uint32_t	Udis;//HRTIM_CR1_TxUDIS
+} Phase[INTLV_PHASES_MAX - 1] =
+{
+	{HRTIM_TIMERINDEX_TIMER_C, HRTIM_TIMRESETTRIGGER_MASTER_CMP2, HRTIM_OUTPUT_TC1, HRTIM_CR1_TCUDIS},
+	{HRTIM_TIMERINDEX_TIMER_D, HRTIM_TIMRESETTRIGGER_MASTER_CMP3, HRTIM_OUTPUT_TD1, HRTIM_CR1_TDUDIS},
+	{HRTIM_TIMERINDEX_TIMER_F, HRTIM_TIMRESETTRIGGER_MASTER_CMP4, HRTIM_OUTPUT_TF1, HRTIM_CR1_TFUDIS},
+};
+
+static const uint32_t PhaseAdc[INTLV_PHASES_MAX] = {ADC_CHANNEL_6, ADC_CHANNEL_7, ADC_CHANNEL_8, ADC_CHANNEL_9};//PC0..PC3
+
+/** ===================================================================
+**     Function Name : void Intlv_AdcInit(void)
+**     Description : ADC2 injected sequence over the phase current
+**                   inputs, software triggered. The ADC12 clock is
+**                   already enabled by the ADC1 MSP.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void Intlv_AdcInit(void)
+{
+	GPIO_InitTypeDef gpio = {0};
+	ADC_InjectionConfTypeDef inj = {0};
+	uint8_t i;
+
+	__HAL_RCC_GPIOC_CLK_ENABLE();
+	gpio.Pin = GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3;
+	gpio.Mode = GPIO_MODE_ANALOG;
+	gpio.Pull = GPIO_NOPULL;
+	HAL_GPIO_Init(GPIOC, &gpio);
+
+	hadc2.Instance = ADC2;
+	hadc2.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+	hadc2.Init.Resolution = ADC_RESOLUTION_12B;
+	hadc2.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+	hadc2.Init.ScanConvMode = ADC_SCAN_ENABLE;
+	hadc2.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+	hadc2.Init.NbrOfConversion = 1;
+	hadc2.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+	hadc2.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	hadc2.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+	if(HAL_ADC_Init(&hadc2) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	inj.InjectedSamplingTime = ADC_SAMPLETIME_24CYCLES_5;
+	inj.InjectedSingleDiff = ADC_SINGLE_ENDED;
+	inj.InjectedOffsetNumber = ADC_OFFSET_NONE;
+	inj.InjectedNbrOfConversion = INTLV_PHASES;
+	inj.InjectedDiscontinuousConvMode = DISABLE;
+	inj.AutoInjectedConv = DISABLE;
+	inj.QueueInjectedContext = DISABLE;
+	inj.ExternalTrigInjecConv = ADC_INJECTED_SOFTWARE_START;
+	inj.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONV_EDGE_NONE;
+	inj.InjecOversamplingMode = DISABLE;
+	for(i = 0; i < INTLV_PHASES; i++)
+	{
+		inj.InjectedChannel = PhaseAdc[i];
+		inj.InjectedRank = ADC_INJECTED_RANK_1 + i;//ranks are consecutive
+		if(HAL_ADCEx_InjectedConfigChannel(&hadc2, &inj) != HAL_OK)
+		{
+			Error_Handler();
+		}
+	}
+	HAL_ADCEx_Calibration_Start(&hadc2, ADC_SINGLE_ENDED);
+	HAL_ADCEx_InjectedStart(&hadc2);
+}
+
+/** ===================================================================
+**     Function Name : void Intlv_Init(void)
+**     Description : Configure Timer C/D/F like Timer A, reset from the
+**                   master compares, and start them. Call after
+**                   UpdateHRTIM() and Samp_Init(), whose ADC1 MSP
+**                   enables the ADC12 clock.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Intlv_Init(void)
+{
+	HRTIM_TimerCfgTypeDef timerConfig = {0};
+	HRTIM_TimerCtlTypeDef timerControl = {0};
+	HRTIM_OutputCfgTypeDef outputConfig = {0};
+	GPIO_InitTypeDef gpio = {0};
+	uint32_t outputs = 0, timers = 0;
+	uint8_t i;
+
+	timerConfig.InterruptRequests = HRTIM_TIM_IT_NONE;
+	timerConfig.DMARequests = HRTIM_TIM_DMA_NONE;
+	timerConfig.DMASize = 0x1;
+	timerConfig.HalfModeEnable = HRTIM_HALFMODE_DISABLED;
+	timerConfig.InterleavedMode = HRTIM_INTERLEAVED_MODE_DISABLED;
+	timerConfig.StartOnSync = HRTIM_SYNCSTART_DISABLED;
+	timerConfig.ResetOnSync = HRTIM_SYNCRESET_DISABLED;
+	timerConfig.DACSynchro = HRTIM_DACSYNC_NONE;
+	timerConfig.PreloadEnable = HRTIM_PRELOAD_ENABLED;
+	timerConfig.UpdateGating = HRTIM_UPDATEGATING_INDEPENDENT;
+	timerConfig.BurstMode = HRTIM_TIMERBURSTMODE_MAINTAINCLOCK;
+	timerConfig.RepetitionUpdate = HRTIM_UPDATEONREPETITION_DISABLED;
+	timerConfig.ReSyncUpdate = HRTIM_TIMERESYNC_UPDATE_UNCONDITIONAL;
+	timerConfig.PushPull = HRTIM_TIMPUSHPULLMODE_DISABLED;
+	timerConfig.FaultEnable = HRTIM_TIMFAULTENABLE_NONE;
+	timerConfig.FaultLock = HRTIM_TIMFAULTLOCK_READWRITE;
+	timerConfig.DeadTimeInsertion = HRTIM_TIMDEADTIMEINSERTION_DISABLED;
+	timerConfig.DelayedProtectionMode = HRTIM_TIMER_D_E_DELAYEDPROTECTION_DISABLED;
+	timerConfig.UpdateTrigger = HRTIM_TIMUPDATETRIGGER_NONE;
+	timerConfig.ResetUpdate = HRTIM_TIMUPDATEONRESET_ENABLED;
+
+	timerControl.UpDownMode = HRTIM_TIMERUPDOWNMODE_UP;
+	timerControl.TrigHalf = HRTIM_TIMERTRIGHALF_DISABLED;
+	timerControl.GreaterCMP1 = HRTIM_TIMERGTCMP1_EQUAL;
+	timerControl.DualChannelDacEnable = HRTIM_TIMER_DCDE_DISABLED;
+
+	outputConfig.Polarity = HRTIM_OUTPUTPOLARITY_HIGH;
+	outputConfig.SetSource = HRTIM_OUTPUTSET_TIMPER;
+	outputConfig.ResetSource = HRTIM_OUTPUTRESET_TIMCMP2;//same edge as TA2, the duty
+	outputConfig.IdleMode = HRTIM_OUTPUTIDLEMODE_IDLE;//burst mode idles all phases
+	outputConfig.IdleLevel = HRTIM_OUTPUTIDLELEVEL_INACTIVE;
+	outputConfig.FaultLevel = HRTIM_OUTPUTFAULTLEVEL_NONE;
+	outputConfig.ChopperModeEnable = HRTIM_OUTPUTCHOPPERMODE_DISABLED;
+	outputConfig.BurstModeEntryDelayed = HRTIM_OUTPUTBURSTMODEENTRY_REGULAR;
+
+	for(i = 0; i < INTLV_PHASES - 1; i++)
+	{
+		timerConfig.ResetTrigger = Phase[i].Reset;
+		if(HAL_HRTIM_TimeBaseConfig(&hhrtim1, Phase[i].Timer, &pGlobalTimeBaseCfg) != HAL_OK
+			|| HAL_HRTIM_WaveformTimerConfig(&hhrtim1, Phase[i].Timer, &timerConfig) != HAL_OK
+			|| HAL_HRTIM_WaveformTimerControl(&hhrtim1, Phase[i].Timer, &timerControl) != HAL_OK
+			|| HAL_HRTIM_WaveformOutputConfig(&hhrtim1, Phase[i].Timer, Phase[i].Output, &outputConfig) != HAL_OK)
+		{
+			Error_Handler();
+		}
+		outputs |= Phase[i].Output;
+		timers |= HRTIM_TIMERID_TIMER_A << (Phase[i].Timer - HRTIM_TIMERINDEX_TIMER_A);
+	}
+
+	//TC1 PB12, TD1 PB14 and TF1 PC6, all AF13
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	__HAL_RCC_GPIOC_CLK_ENABLE();
+	gpio.Mode = GPIO_MODE_AF_PP;
+	gpio.Pull = GPIO_NOPULL;
+	gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	gpio.Alternate = GPIO_AF13_HRTIM1;
+	gpio.Pin = GPIO_PIN_12 | GPIO_PIN_14;
+	HAL_GPIO_Init(GPIOB, &gpio);
+	gpio.Pin = GPIO_PIN_6;
+	HAL_GPIO_Init(GPIOC, &gpio);
+
+	Intlv.Active = INTLV_PHASES;
+	HRTIM_Apply();
+	HAL_HRTIM_SoftwareUpdate(&hhrtim1, HRTIM_TIMERUPDATE_MASTER | HRTIM_TIMERUPDATE_C
+		| HRTIM_TIMERUPDATE_D | HRTIM_TIMERUPDATE_F);
+	HAL_HRTIM_WaveformCounterStart(&hhrtim1, timers);
+	HRTIM1->sCommonRegs.OENR = outputs;
+
+	Intlv_AdcInit();
+}
+
+/** ===================================================================
+**     Function Name : void Intlv_Apply(int32_t d2, int32_t per)
+**     Description : Period, duty and phase of the interleaved timers,
+**                   control ISR (closed loop) or main loop (open loop)
+**                   through HRTIM_Apply(), with updates disabled
+**     Parameters  : d2 - duty compare of phase 0, per - period
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Intlv_Apply(int32_t d2, int32_t per)
+{
+	volatile uint32_t *mcmp[INTLV_PHASES_MAX - 1] =
+		{&HRTIM1->sMasterRegs.MCMP2R, &HRTIM1->sMasterRegs.MCMP3R, &HRTIM1->sMasterRegs.MCMP4R};
+	uint8_t active = Intlv.Active;
+	int32_t d;
+	uint8_t i;
+
+	for(i = 0; i < INTLV_PHASES - 1; i++)
+	{
+		d = d2 + Intlv.Trim[i + 1];
+		if(d < HRTIM_CMP_MIN)
+			d = HRTIM_CMP_MIN;
+		if(d > per - HRTIM_CMP_MIN)
+			d = per - HRTIM_CMP_MIN;
+		HRTIM1->sTimerxRegs[Phase[i].Timer].PERxR = per;
+		HRTIM1->sTimerxRegs[Phase[i].Timer].CMP2xR = d;
+		if(i + 1 < active)
+			*mcmp[i] = per * (i + 1) / active;
+	}
+}
+
+/** ===================================================================
+**     Function Name : void Intlv_Phases(uint8_t n)
+**     Description : Switch the number of active phases; outputs of the
+**                   dropped phases are disabled, the rest re-spread at
+**                   the next HRTIM_Apply()
+**     Parameters  : n - 1..INTLV_PHASES
+**     Returns     :
+** ===================================================================*/
+static void Intlv_Phases(uint8_t n)
+{
+	uint32_t on = 0, off = 0;
+	uint8_t i;
+
+	for(i = 0; i < INTLV_PHASES - 1; i++)
+	{
+		if(i + 1 < n)
+			on |= Phase[i].Output;
+		else
+			off |= Phase[i].Output;
+	}
+	if(off)
+		HRTIM1->sCommonRegs.ODISR = off;
+	Intlv.Active = n;
+	if(on && DF.ErrFlag == F_NOERR)
+		HRTIM1->sCommonRegs.OENR = on;
+	Intlv.Changes++;
+}
+
+/** ===================================================================
+**     Function Name : void Intlv_Task(void)
+**     Description : Current balancing and phase shedding, scheduled
+**                   every INTLV_PERIOD_MS
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Intlv_Task(void)
+{
+	struct _SNAP snap;
+	int32_t mean = 0, net, trim;
+	uint8_t n = Intlv.Active;
+	uint8_t i;
+
+	if(__HAL_ADC_GET_FLAG(&hadc2, ADC_FLAG_JEOS))
+	{
+		for(i = 0; i < INTLV_PHASES; i++)
+			Intlv.I[i] = (uint16_t)HAL_ADCEx_InjectedGetValue(&hadc2, ADC_INJECTED_RANK_1 + i);
+		HAL_ADCEx_InjectedStart(&hadc2);
+	}
+
+	for(i = 0; i < n; i++)
+		mean += Intlv.I[i];
+	mean /= n;
+	for(i = 1; i < INTLV_PHASES; i++)
+	{
+		trim = 0;
+		if(i < n && currentMode == MODE_CLOSE_LOOP)
+		{
+			trim = Intlv.Trim[i] + ((mean - Intlv.I[i]) >> INTLV_TRIM_SHIFT);
+			if(trim > INTLV_TRIM_MAX)
+				trim = INTLV_TRIM_MAX;
+			if(trim < -INTLV_TRIM_MAX)
+				trim = -INTLV_TRIM_MAX;
+		}
+		Intlv.Trim[i] = (int16_t)trim;
+	}
+
+	if(!Intlv.Shed)
+		return;
+
+	Tele_Read(&snap);
+	net = snap.Adc.IoutAvg - 2048;
+	if(n < INTLV_PHASES && net > n * INTLV_I_PHASE + INTLV_I_HYST)
+		Intlv_Phases(n + 1);
+	else if(n > 1 && net < (n - 1) * INTLV_I_PHASE - INTLV_I_HYST)
+		Intlv_Phases(n - 1);
+}
+
+/** ===================================================================
+**     Function Name : void Intlv_SetShed(uint8_t en)
+**     Description : Enable phase shedding; off brings all phases back
+**     Parameters  : en - 1 on, 0 off
+**     Returns     :
+** ===================================================================*/
+void Intlv_SetShed(uint8_t en)
+{
+	Intlv.Shed = en;
+	if(!en && Intlv.Active != INTLV_PHASES)
+		Intlv_Phases(INTLV_PHASES);
+}
+
+#else
+
+void Intlv_Init(void)
+{
+}
+
+CCMRAM void Intlv_Apply(int32_t d2, int32_t per)
+{
+	(void)d2;
+	(void)per;
+}
+
+void Intlv_Task(void)
+{
+}
+
+void Intlv_SetShed(uint8_t en)
+{
+	(void)en;
+}
+
+#endif
@@ -0,0 +1,63 @@
+/** ===================================================================
+**     File Name   : irqprio.c
+**     Description : Checks of the interrupt priority plan in irqprio.h
+**
+**     The control ISR must preempt every other interrupt, the ADC path
+**     that feeds it comes next, and communication and display DMA sit
+**     below the scheduler tick. The ordering is enforced at compile
+**     time; IrqPrio_Check() reads the NVIC back at boot so a priority
+**     changed by CubeMX regeneration or by hand shows up in telemetry.
+** ===================================================================*/
+
+#include "irqprio.h"
+
+//Compile time checks, a failing condition gives a negative array size
+#define PRIO_ASSERT(name, cond)	typedef char prio_##name[(cond) ? 1 : -1]
+
+PRIO_ASSERT(sysTick_in_range, PRIO_SYSTICK < (1u << __NVIC_PRIO_BITS));
+PRIO_ASSERT(ctl_preempts_adc, PRIO_CTL_ISR < PRIO_ADC_ISR && PRIO_CTL_ISR < PRIO_ADC_DMA);
+PRIO_ASSERT(adc_above_tick, PRIO_ADC_ISR < PRIO_TICK_ISR && PRIO_ADC_DMA < PRIO_TICK_ISR);
+PRIO_ASSERT(tick_above_comms, PRIO_TICK_ISR < PRIO_UART_ISR && PRIO_TICK_ISR < PRIO_UART_DMA);
+PRIO_ASSERT(comms_above_display, PRIO_UART_ISR <= PRIO_I2C_DMA && PRIO_UART_DMA <= PRIO_I2C_DMA);
+PRIO_ASSERT(display_above_systick, PRIO_I2C_DMA < PRIO_SYSTICK);
+
+static const struct
+{
+	IRQn_Type	Irq;
+	uint8_t		Prio;
+} IrqPrioTab[] =
+{
+	{HRTIM1_TIMA_IRQn,		PRIO_CTL_ISR},
+	{ADC1_2_IRQn,			PRIO_ADC_ISR},
+	{DMA1_Channel1_IRQn,	PRIO_ADC_DMA},
+	{TIM2_IRQn,				PRIO_TICK_ISR},
+	{USART2_IRQn,			PRIO_UART_ISR},
+	{DMA1_Channel3_IRQn,	PRIO_UART_DMA},
+	{DMA1_Channel2_IRQn,	PRIO_I2C_DMA},
+	{SysTick_IRQn,			PRIO_SYSTICK},
+};
+
+uint16_t IrqPrioErr = 0;
+
+/** ===================================================================
+**     Function Name : uint16_t IrqPrio_Check(void)
+**     Description : Compare the NVIC settings with the priority plan,
+**                   call once all peripherals are initialised
+**     Parameters  :
+**     Returns     : IrqPrioErr, 0 if everything matches
+** ===================================================================*/
+uint16_t IrqPrio_Check(void)
+{
+	uint8_t i;
+
+	IrqPrioErr = 0;
+	if(NVIC_GetPriorityGrouping() != NVIC_PRIORITYGROUP_4)
+		IrqPrioErr |= PRIO_ERR_GROUP;
+
+	for(i = 0; i < sizeof(IrqPrioTab) / sizeof(IrqPrioTab[0]); i++)
+	{
+		if(NVIC_GetPriority(IrqPrioTab[i].Irq) != IrqPrioTab[i].Prio)
+			IrqPrioErr |= (uint16_t)(1u << i);
+	}
+	return IrqPrioErr;
+}
@@ -30,6 +30,16 @@
 /* USER CODE BEGIN Includes */
 #include "oled.h"
 #include "function.h"
+#include "telemetry.h"
+#include "sched.h"
+#include "boot.h"
+#include "interleave.h"
+#include "burst.h"
+#include "pcmc.h"
+#include "cal.h"
+#include "params.h"
+#include "evlog.h"
+#include "sample.h"
 
 #include "stdio.h"
 #include "string.h"
@@ -92,38 +102,43 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  Boot_Start(); // Boot clock for the phase log
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
   MX_DMA_Init();
   //MX_HRTIM1_Init();
-  UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
-
-
-  MX_USART2_UART_Init();
-  MX_I2C3_Init();
   MX_TIM2_Init();
-  MX_ADC1_Init();
   /* USER CODE BEGIN 2 */
-	Open_Mode_Init(); // Initialize OLED display
-	
-
-	HAL_TIM_Base_Start_IT(&htim2); // Start timer 3 at 200Hz
-
-	HAL_ADC_Start_DMA(&hadc1, (uint32_t*)ADC1_RESULT, 4); // Start ADC1 sampling, DMA transfer for sampling input/output voltage and current
-	HAL_ADC_Start(&hadc1); // Start ADC2 sampling, sampling the sliding potentiometer voltage
+	// USART2, I2C3 and the OLED are brought up later by Boot_Task()
+	// ADC1 is set up by Samp_Init(), its MX_ADC1_Init() call is not generated
+	Param_Load(); // Stored set points and limits, before the HRTIM takes them
+	UpdateHRTIM(gPerioid, gHalf, gDuty, gDeadTime);
+	Samp_Init(); // ADC1 oversampled regular scan and HRTIM triggered injected group
+	Boot_Mark(BOOT_HRTIM);
+
+	Cal_Load(); // Per unit ADC calibration from flash, before the first sample
+	Log_Init(); // Find the end of the event log, record the reset cause
+	Samp_Start(); // Start ADC1 sampling: Vin/Iin by DMA, Vout/Iout on every HRTIM period
+	Boot_Mark(BOOT_ADC);
 
 	// Ұʥ| PWM X]TA1BTA2BTB1BTB2^
 	HAL_HRTIM_WaveformOutputStart(&hhrtim1, HRTIM_OUTPUT_TA1 | HRTIM_OUTPUT_TA2 | HRTIM_OUTPUT_TB1 | HRTIM_OUTPUT_TB2); // Enable all PWM outputs
 	
 	// Ұʭpɾ A M B
 	HAL_HRTIM_WaveformCounterStart(&hhrtim1, HRTIM_TIMERID_TIMER_A | HRTIM_TIMERID_TIMER_B); // Start both PWM timers
+	Intlv_Init(); // Interleaved phases on Timer C/D/F, nothing with INTLV_PHASES 1
+	Burst_Init(); // Burst mode controller, engaged by Burst_Task()
+	Pcmc_Init(); // COMP1/DAC3 peak current path, used with MOD_PCMC
 	
 	// ҥέpɾ A _
 	__HAL_HRTIM_TIMER_ENABLE_IT(&hhrtim1, HRTIM_TIMERINDEX_TIMER_A, HRTIM_TIM_IT_REP); // Enable interrupt for timer A
 
+	Sched_Init();
+	HAL_TIM_Base_Start_IT(&htim2); // Start TIM2, 100uS scheduler tick
+	Boot_Mark(BOOT_CTL);
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -133,7 +148,8 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
-    Button_Task();
+    // Keys, events, protection, display and telemetry, see TaskTab in sched.c
+    Sched_Run();
   }
   /* USER CODE END 3 */
 }
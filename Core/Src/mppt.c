@@ -0,0 +1,185 @@
+/** ===================================================================
+**     File Name   : mppt.c
+**     Description : Maximum power point tracking on the input side
+**
+**     The tracker only moves CtrValue.VinRef. The input voltage loop in
+**     the control ISR (VinLoop, see BUCKLoopSelect) holds Vin at that
+**     reference by taking duty away when the source sags below it, so
+**     the tracker sits on top of the CV/CC/CP loops: when the output
+**     side limits first, the operating point simply moves right of the
+**     MPP and the tracker keeps following the power it is given.
+**
+**     Mppt_Task runs every MPPT_PERIOD_MS and averages one snapshot
+**     per pass; every Interval passes the averaged Vin/Iin go through
+**     the selected algorithm:
+**       P&O   : keep the direction while P rises, reverse when it falls
+**       IncCond: dP/dV = I + V*dI/dV, move towards its sign and
+**                hold inside MPPT_INC_TOL. A Vin change under half
+**                a step is noise, not a move: only dI counts then.
+**     The interval has to cover the settling of the input voltage loop
+**     and of the source, otherwise both algorithms track the transient.
+**     Needs the Vin and Iin sense; on a board without them (sample.h)
+**     MPPT cannot be enabled.
+** ===================================================================*/
+
+#include "mppt.h"
+#include "telemetry.h"
+#include "sample.h"
+
+struct _MPPT Mppt = {MPPT_ALG_OFF, MPPT_INTERVAL_DEF, MPPT_STEP_DEF, 1, 0, 0, 0, 0, 0, 0, 0};
+
+/** ===================================================================
+**     Function Name : void Mppt_Restart(void)
+**     Description : Drop the averages and the history, the next
+**                   interval starts tracking from scratch
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void Mppt_Restart(void)
+{
+	Mppt.Cnt = 0;
+	Mppt.VSum = 0;
+	Mppt.ISum = 0;
+	Mppt.VLast = 0;
+	Mppt.ILast = 0;
+	Mppt.PLast = 0;
+}
+
+/** ===================================================================
+**     Function Name : void Mppt_Set(uint8_t alg, int16_t step, uint8_t interval)
+**     Description : Select the algorithm and its parameters. Enabling
+**                   starts at the present input voltage, so the input
+**                   voltage loop takes over without a step. Refused
+**                   without the Vin/Iin sense (SAMP_FLAGS_NA).
+**     Parameters  : alg - MPPT_ALG_xxx, step - VinRef step Q12,
+**                   interval - Mppt_Task passes per step
+**     Returns     :
+** ===================================================================*/
+void Mppt_Set(uint8_t alg, int16_t step, uint8_t interval)
+{
+	struct _SNAP snap;
+
+	if(step > 0)
+		Mppt.Step = step;
+	if(interval > 0)
+		Mppt.Interval = interval;
+	Mppt_Restart();
+
+	if(alg == MPPT_ALG_OFF)
+	{
+		DF.CtrFlag &= ~CTR_MPPT_EN;
+		Mppt.Alg = MPPT_ALG_OFF;
+		return;
+	}
+
+	if(SAMP_FLAGS_NA & CTR_MPPT_EN)
+		return;
+
+	Tele_Read(&snap);
+	if((DF.CtrFlag & CTR_MPPT_EN) == 0)
+		CtrValue.VinRef = snap.Adc.VinAvg;
+	Mppt.Alg = alg;
+	Mppt.Dir = -1;//first move towards lower Vin, i.e. more load on the source
+	DF.CtrFlag |= CTR_MPPT_EN;
+}
+
+/** ===================================================================
+**     Function Name : int8_t Mppt_PO(int32_t v, int32_t p)
+**     Description : Perturb and observe
+**     Parameters  : v - averaged Vin, p - averaged input power
+**     Returns     : direction of the next VinRef step
+** ===================================================================*/
+static int8_t Mppt_PO(int32_t v, int32_t p)
+{
+	(void)v;
+	if(p < Mppt.PLast)
+		return (int8_t)-Mppt.Dir;
+	return Mppt.Dir;
+}
+
+/** ===================================================================
+**     Function Name : int8_t Mppt_Inc(int32_t v, int32_t i)
+**     Description : Incremental conductance
+**     Parameters  : v - averaged Vin, i - averaged Iin above 0A
+**     Returns     : direction of the next VinRef step, 0 to hold
+** ===================================================================*/
+static int8_t Mppt_Inc(int32_t v, int32_t i)
+{
+	int32_t dv = v - Mppt.VLast;
+	int32_t di = i - Mppt.ILast;
+	int32_t g;
+
+	if(dv < Mppt.Step / 2 && dv > -Mppt.Step / 2)//VinRef held
+	{
+		if(di < MPPT_INC_TOL && di > -MPPT_INC_TOL)
+			return 0;
+		return (di > 0) ? 1 : -1;//irradiance change at the same Vin
+	}
+
+	g = i + v * di / dv;//dP/dV
+	if(g < MPPT_INC_TOL && g > -MPPT_INC_TOL)
+		return 0;
+	return (g > 0) ? 1 : -1;
+}
+
+/** ===================================================================
+**     Function Name : void Mppt_Task(void)
+**     Description : Scheduled every MPPT_PERIOD_MS, main loop context.
+**                   Idle unless closed loop, no fault and an algorithm
+**                   is selected.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Mppt_Task(void)
+{
+	struct _SNAP snap;
+	int32_t v, i, p, ref;
+	int8_t dir;
+
+	if(Mppt.Alg == MPPT_ALG_OFF || currentMode != MODE_CLOSE_LOOP || DF.ErrFlag != F_NOERR)
+	{
+		Mppt_Restart();
+		return;
+	}
+
+	Tele_Read(&snap);
+	Mppt.VSum += snap.Adc.VinAvg;
+	Mppt.ISum += snap.Adc.IinAvg - 2048;
+	if(++Mppt.Cnt < Mppt.Interval)
+		return;
+
+	v = Mppt.VSum / Mppt.Cnt;
+	i = Mppt.ISum / Mppt.Cnt;
+	p = v * i >> 11;//same scale as struct _POWER
+	Mppt.Cnt = 0;
+	Mppt.VSum = 0;
+	Mppt.ISum = 0;
+
+	if(Mppt.VLast == 0)
+		dir = Mppt.Dir;//first interval, nothing to compare with
+	else if(Mppt.Alg == MPPT_ALG_INC)
+		dir = Mppt_Inc(v, i);
+	else
+		dir = Mppt_PO(v, p);
+
+	Mppt.VLast = v;
+	Mppt.ILast = i;
+	Mppt.PLast = p;
+	if(dir == 0)
+		return;
+
+	ref = CtrValue.VinRef + dir * Mppt.Step;
+	if(ref > MPPT_VIN_MAX)
+	{
+		ref = MPPT_VIN_MAX;
+		dir = -1;
+	}
+	else if(ref < MPPT_VIN_MIN)
+	{
+		ref = MPPT_VIN_MIN;
+		dir = 1;
+	}
+	CtrValue.VinRef = ref;//single aligned word, read by the control ISR
+	Mppt.Dir = dir;
+	Mppt.Steps++;
+}
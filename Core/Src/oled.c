@@ -42,6 +42,15 @@ void OLED_Init(void)
 {
 	HAL_Delay(200); //ʱҪ
 
+	OLED_InitSeq();
+
+	HAL_Delay(100);
+}
+
+//Controller set-up without the power-up delays, the boot sequence in
+//boot.c waits for them with the scheduler instead of HAL_Delay
+void OLED_InitSeq(void)
+{
 	WriteCmd(0xAE); //display off
 	WriteCmd(0x20);	//Set Memory Addressing Mode	
 	WriteCmd(0x10);	//00,Horizontal Addressing Mode;01,Vertical Addressing Mode;10,Page Addressing Mode (RESET);11,Invalid
@@ -70,8 +79,6 @@ void OLED_Init(void)
 	WriteCmd(0x8d); //--set DC-DC enable
 	WriteCmd(0x14); //
 	WriteCmd(0xaf); //--turn on oled panel
-	
-	HAL_Delay(100);
 }
 
 void OLED_SetPos(unsigned char x, unsigned char y) //ʼ
@@ -96,6 +103,18 @@ void OLED_Fill(unsigned char fill_Data)//ȫ
 	}
 }
 
+void OLED_FillPage(unsigned char page, unsigned char fill_Data)//ҳ
+{
+	unsigned char n;
+	WriteCmd(0xb0+page);
+	WriteCmd(0x00);
+	WriteCmd(0x10);
+	for(n=0;n<128;n++)
+	{
+		WriteDat(fill_Data);
+	}
+}
+
 void OLED_CLS(void)//
 {
 	OLED_Fill(0x00);
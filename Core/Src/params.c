@@ -0,0 +1,312 @@
+/** ===================================================================
+**     File Name   : params.c
+**     Description : Wear levelled key/value store for set points,
+**                   limits and tuning
+**
+**     FLASH_PARAM_PAGES pages are used as a ring. Each page starts with
+**     a header double word (magic, generation Seq) followed by entries
+**     of one double word each: key, check, value. A new value is one
+**     entry appended to the active page, so a save is a single double
+**     word program and a value is either completely there or not at
+**     all; the newest entry of a key wins.
+**
+**     When the active page is full, the newest value of every key is
+**     copied into the next page of the ring and that page's header is
+**     written last. A power failure before the header leaves the old
+**     page in charge, so the store is never without a valid copy.
+**     At boot the page with the highest generation is scanned once
+**     into the RAM index Param, all lookups go there. A header or entry
+**     left half programmed by a reset fails its ECC; the scan skips it.
+**
+**     Param_Task saves a live value once it has stayed unchanged for
+**     PARAM_SETTLE passes, one entry per pass. Values moved by an
+**     optimiser (FreqOpt, adaptive dead time) are not saved while it
+**     runs, nor is the duty in closed loop. Erase and program run in
+**     the main loop on bank 2 while all code, the control ISR included,
+**     is fetched from bank 1. With DBANK set the two banks read while
+**     the other writes, so the ISR is not stalled by the flash; only
+**     part of it sits in CCM RAM, it calls HAL and helpers in flash.
+** ===================================================================*/
+
+#include "params.h"
+#include "flash.h"
+#include "telemetry.h"
+#include "freqopt.h"
+#include "dtopt.h"
+#include "sample.h"
+
+#define PARAM_ENT_NUM	((FLASH_PAGE_SIZE - 8) / 8)//entries per page after the header
+#define PARAM_KEY_NONE	0xFFFFu//erased
+
+struct _PARAM_HDR
+{
+	uint32_t	Magic;
+	uint32_t	Seq;
+};
+
+struct _PARAM_ENT
+{
+	uint16_t	Key;
+	uint16_t	Chk;//see Param_Chk()
+	uint32_t	Value;
+};
+
+typedef char ParamEntCheck[(sizeof(struct _PARAM_ENT) == 8 && sizeof(struct _PARAM_HDR) == 8
+	&& PARAM_KEY_NUM <= 16) ? 1 : -1];
+
+struct _PARAM Param = {0};
+
+static uint16_t Param_Chk(uint16_t key, uint32_t value)
+{
+	return (uint16_t)~(key ^ value ^ (value >> 16) ^ 0x5AA5u);
+}
+
+static uint32_t Param_PageAddr(uint8_t page)
+{
+	return FLASH_PARAM_ADDR + (uint32_t)page * FLASH_PAGE_SIZE;
+}
+
+/** ===================================================================
+**     Function Name : void Param_Apply(void)
+**     Description : Copy the stored values that pass a range check
+**                   to the variables they belong to
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void Param_Apply(void)
+{
+	uint32_t *v = Param.Value;
+	uint16_t ok = Param.Valid;
+
+	if((ok & (1u << PARAM_PERIOD)) && v[PARAM_PERIOD] >= FreqMin && v[PARAM_PERIOD] <= FreqMax)
+		gPerioid = v[PARAM_PERIOD];
+	if((ok & (1u << PARAM_DUTY)) && v[PARAM_DUTY] < 16000)
+		gDuty = v[PARAM_DUTY];
+	if((ok & (1u << PARAM_DEADTIME)) && v[PARAM_DEADTIME] < (uint32_t)gHalf)
+		gDeadTime = v[PARAM_DEADTIME];
+	if((ok & (1u << PARAM_DT_A)) && v[PARAM_DT_A] >= DT_MIN_TICKS && v[PARAM_DT_A] <= DT_MAX_TICKS)
+		gDtLeg[0] = v[PARAM_DT_A];
+	if((ok & (1u << PARAM_DT_B)) && v[PARAM_DT_B] >= DT_MIN_TICKS && v[PARAM_DT_B] <= DT_MAX_TICKS)
+		gDtLeg[1] = v[PARAM_DT_B];
+	if((ok & (1u << PARAM_ILIMIT)) && v[PARAM_ILIMIT] > 2048 && v[PARAM_ILIMIT] < 4096)
+		CtrValue.ILimit = v[PARAM_ILIMIT];
+	if((ok & (1u << PARAM_PLIMIT)) && v[PARAM_PLIMIT] > 0 && v[PARAM_PLIMIT] <= 4096)
+		CtrValue.PLimit = v[PARAM_PLIMIT];
+	if((ok & (1u << PARAM_VSET)) && v[PARAM_VSET] < 4096)
+		CtrValue.VSet = v[PARAM_VSET];
+	else
+		ok &= ~(1u << PARAM_VSET);
+	if(ok & (1u << PARAM_CTRFLAG))
+		DF.CtrFlag = ((DF.CtrFlag & ~PARAM_FLAG_MASK) | (v[PARAM_CTRFLAG] & PARAM_FLAG_MASK)) & ~SAMP_FLAGS_NA;
+	if((ok & (1u << PARAM_VSET)) == 0)
+		DF.CtrFlag &= ~CTR_VSET_FIX;//no stored set point, stay on the potentiometer
+}
+
+/** ===================================================================
+**     Function Name : void Param_Load(void)
+**     Description : Find the newest page, build the RAM index and
+**                   apply the values; at boot before UpdateHRTIM()
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Param_Load(void)
+{
+	struct _PARAM_HDR hdr;
+	struct _PARAM_ENT ent;
+	uint16_t i;
+	uint8_t page;
+
+	for(page = 0; page < FLASH_PARAM_PAGES; page++)
+	{
+		if(Flash_Read(&hdr, Param_PageAddr(page), sizeof(hdr)) != HAL_OK)
+			continue;//header write cut short, the page never took over
+		if(hdr.Magic == PARAM_MAGIC && (!Param.Ok || hdr.Seq > Param.Seq))
+		{
+			Param.Page = page;
+			Param.Seq = hdr.Seq;
+			Param.Ok = 1;
+		}
+	}
+	if(!Param.Ok)
+		return;
+
+	for(i = 0; i < PARAM_ENT_NUM; i++)
+	{
+		if(Flash_Read(&ent, Param_PageAddr(Param.Page) + 8 + i * 8u, sizeof(ent)) != HAL_OK)
+			continue;//torn entry, its slot stays used
+		if(ent.Key == PARAM_KEY_NONE && ent.Chk == 0xFFFFu && ent.Value == 0xFFFFFFFFu)
+			break;//end of the log
+		if(ent.Key < PARAM_KEY_NUM && ent.Chk == Param_Chk(ent.Key, ent.Value))
+		{
+			Param.Value[ent.Key] = ent.Value;
+			Param.Valid |= 1u << ent.Key;
+		}
+	}
+	Param.Next = i;
+	Param_Apply();
+}
+
+/** ===================================================================
+**     Function Name : HAL_StatusTypeDef Param_Compact(void)
+**     Description : Move the newest values to the next page of the
+**                   ring, header last
+**     Parameters  :
+**     Returns     : HAL_OK, or the flash error
+** ===================================================================*/
+static HAL_StatusTypeDef Param_Compact(void)
+{
+	struct _PARAM_HDR hdr;
+	struct _PARAM_ENT ent;
+	uint8_t page = Param.Ok ? (uint8_t)((Param.Page + 1) % FLASH_PARAM_PAGES) : 0;
+	uint32_t addr = Param_PageAddr(page);
+	uint16_t n = 0;
+	uint8_t key;
+
+	if(Flash_Erase(addr, 1) != HAL_OK)
+		return HAL_ERROR;
+	Param.Erases++;
+
+	for(key = 1; key < PARAM_KEY_NUM; key++)
+	{
+		if((Param.Valid & (1u << key)) == 0)
+			continue;
+		ent.Key = key;
+		ent.Value = Param.Value[key];
+		ent.Chk = Param_Chk(key, ent.Value);
+		if(Flash_Write(addr + 8 + n * 8u, &ent, sizeof(ent)) != HAL_OK)
+			return HAL_ERROR;
+		n++;
+	}
+
+	hdr.Magic = PARAM_MAGIC;
+	hdr.Seq = Param.Seq + 1;
+	if(Flash_Write(addr, &hdr, sizeof(hdr)) != HAL_OK)
+		return HAL_ERROR;
+
+	Param.Page = page;
+	Param.Seq = hdr.Seq;
+	Param.Ok = 1;
+	Param.Next = n;
+	Param.Writes += n;
+	Param.Dirty = 0;
+	return HAL_OK;
+}
+
+/** ===================================================================
+**     Function Name : void Param_Flush(uint8_t key)
+**     Description : Append the value of one key, compacting first if
+**                   the active page is full
+**     Parameters  : key - PARAM_xxx
+**     Returns     :
+** ===================================================================*/
+static void Param_Flush(uint8_t key)
+{
+	struct _PARAM_ENT ent;
+
+	if(!Param.Ok || Param.Next >= PARAM_ENT_NUM)
+	{
+		Param_Compact();//writes every dirty key
+		return;
+	}
+
+	ent.Key = key;
+	ent.Value = Param.Value[key];
+	ent.Chk = Param_Chk(key, ent.Value);
+	if(Flash_Write(Param_PageAddr(Param.Page) + 8 + Param.Next++ * 8u, &ent, sizeof(ent)) != HAL_OK)
+		return;//the slot may be half programmed, the retry takes the next one
+	Param.Writes++;
+	Param.Dirty &= ~(1u << key);
+}
+
+/** ===================================================================
+**     Function Name : void Param_Watch(uint8_t key, uint32_t v, uint8_t en)
+**     Description : Take a live value into the index once it settled
+**     Parameters  : key - PARAM_xxx, v - live value
+**                   en - 0 while the value must not be saved
+**     Returns     :
+** ===================================================================*/
+static void Param_Watch(uint8_t key, uint32_t v, uint8_t en)
+{
+	if(!en || ((Param.Valid & (1u << key)) && Param.Value[key] == v))
+	{
+		Param.Cnt[key] = 0;
+		return;
+	}
+	if(v != Param.Cand[key])
+	{
+		Param.Cand[key] = v;
+		Param.Cnt[key] = 0;
+		if(!Param.Now)
+			return;
+	}
+	if(Param.Now || ++Param.Cnt[key] >= PARAM_SETTLE)
+	{
+		Param.Value[key] = v;
+		Param.Valid |= 1u << key;
+		Param.Dirty |= 1u << key;
+		Param.Cnt[key] = 0;
+	}
+}
+
+/** ===================================================================
+**     Function Name : void Param_Task(void)
+**     Description : Watch the live values and save at most one entry,
+**                   scheduled every PARAM_PERIOD_MS
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Param_Task(void)
+{
+	struct _SNAP snap;
+	uint8_t open, key;
+
+	if(Param.Off)
+		return;
+
+	Tele_Read(&snap);
+	open = (snap.Mode == MODE_OPEN_LOOP);
+	Param_Watch(PARAM_PERIOD, (uint32_t)snap.Perioid, !FreqOpt.En);
+	Param_Watch(PARAM_DUTY, (uint32_t)snap.Duty, open);
+	Param_Watch(PARAM_DEADTIME, (uint32_t)snap.DeadTime, open && (snap.Flag.CtrFlag & CTR_PSFB) == 0);
+	Param_Watch(PARAM_DT_A, (uint32_t)gDtLeg[0], DtOpt.Mode != DT_MODE_ADAPT);
+	Param_Watch(PARAM_DT_B, (uint32_t)gDtLeg[1], DtOpt.Mode != DT_MODE_ADAPT);
+	Param_Watch(PARAM_ILIMIT, (uint32_t)snap.Ctr.ILimit, 1);
+	Param_Watch(PARAM_PLIMIT, (uint32_t)snap.Ctr.PLimit, 1);
+	Param_Watch(PARAM_CTRFLAG, snap.Flag.CtrFlag & PARAM_FLAG_MASK, 1);
+	Param_Watch(PARAM_VSET, (uint32_t)snap.Ctr.VSet, (snap.Flag.CtrFlag & CTR_VSET_FIX) != 0);
+	Param.Now = 0;
+
+	for(key = 1; key < PARAM_KEY_NUM; key++)
+	{
+		if(Param.Dirty & (1u << key))
+		{
+			Param_Flush(key);
+			break;
+		}
+	}
+}
+
+/** ===================================================================
+**     Function Name : void Param_Cmd(const uint8_t *data, uint8_t len)
+**     Description : CMD_PARAM, see the PARAM_OP_xxx codes
+**     Parameters  : data - command data, len - bytes
+**     Returns     :
+** ===================================================================*/
+void Param_Cmd(const uint8_t *data, uint8_t len)
+{
+	if(len < 1)
+		return;
+
+	if(data[0] == PARAM_OP_SAVE)
+		Param.Now = 1;
+	else if(data[0] == PARAM_OP_ERASE)
+	{
+		Param.Off = 1;
+		Param.Ok = 0;
+		Param.Valid = 0;
+		Param.Dirty = 0;
+		Param.Next = 0;
+		if(Flash_Erase(FLASH_PARAM_ADDR, FLASH_PARAM_PAGES) == HAL_OK)
+			Param.Erases += FLASH_PARAM_PAGES;
+	}
+}
@@ -0,0 +1,174 @@
+/** ===================================================================
+**     File Name   : pcmc.c
+**     Description : Peak current mode control with DAC slope
+**                   compensation
+**
+**     Timer A sets TA1/TA2 at the period as usual. COMP1 compares the
+**     current sense on PB1 with DAC3 channel 1 and resets both outputs
+**     through external event 4 as soon as the current reaches the
+**     threshold. CMP1/CMP2 stay as the maximum duty backstop.
+**
+**     DAC3 runs in sawtooth mode. Timer E, which has no outputs on
+**     this board (PC8/PC9 are I2C3), only provides the DAC triggers:
+**     its counter reset reloads the start value, and its CMP2 event
+**     steps the ramp down PCMC_STEPS times per period. The ramp is the
+**     slope compensation, PCMC_SLOPE over a full period.
+**
+**     The voltage loop keeps running in the control ISR; with
+**     CTR_PCMC its output is the start value of the ramp, i.e. the
+**     peak current, written through Pcmc_SetRef(). The start value is
+**     taken over by the DAC at the next reset trigger, so a ramp never
+**     mixes two references.
+**
+**     The DAC and COMP have no HAL driver in this project, they are
+**     set up at register level.
+** ===================================================================*/
+
+#include "pcmc.h"
+#include "hrtim.h"
+
+extern HRTIM_TimeBaseCfgTypeDef pGlobalTimeBaseCfg;
+
+typedef char PcmcRangeCheck[(PCMC_REF_MAX <= 4095 && PCMC_REF_MIN < PCMC_REF_MAX
+	&& PCMC_SLOPE < PCMC_REF_MIN && PCMC_STEPS > 0) ? 1 : -1];
+
+/** ===================================================================
+**     Function Name : void Pcmc_Init(void)
+**     Description : COMP1, DAC3 sawtooth, HRTIM external event 4 and
+**                   Timer E as DAC trigger source. Leaves the PWM in
+**                   voltage mode, see Pcmc_Enable(). Call after
+**                   UpdateHRTIM().
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Pcmc_Init(void)
+{
+	HRTIM_EventCfgTypeDef eventConfig = {0};
+	HRTIM_TimerCfgTypeDef timerConfig = {0};
+	HRTIM_TimerCtlTypeDef timerControl = {0};
+	GPIO_InitTypeDef gpio = {0};
+
+	//PB1 current sense, COMP1_INP (INPSEL = 1)
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	gpio.Pin = GPIO_PIN_1;
+	gpio.Mode = GPIO_MODE_ANALOG;
+	gpio.Pull = GPIO_NOPULL;
+	HAL_GPIO_Init(GPIOB, &gpio);
+
+	//DAC3 channel 1, internal only, sawtooth from PCMC_REF_MIN downwards
+	__HAL_RCC_DAC3_CLK_ENABLE();
+	DAC3->MCR = DAC_MCR_HFSEL_0//AHB above 80MHz
+		| (3u << DAC_MCR_MODE1_Pos);//connected to on chip peripherals, no buffer
+	DAC3->STR1 = ((uint32_t)PCMC_REF_MIN << DAC_STR1_STRSTDATA1_Pos)
+		| ((uint32_t)(PCMC_SLOPE * 16 / PCMC_STEPS) << DAC_STR1_STINCDATA1_Pos);//12.4 fixed point, STDIR1 = 0 down
+	DAC3->STMODR = ((uint32_t)PCMC_DAC_RST_TRG << DAC_STMODR_STRSTTRIGSEL1_Pos)
+		| ((uint32_t)PCMC_DAC_STEP_TRG << DAC_STMODR_STINCTRIGSEL1_Pos);
+	DAC3->CR = (3u << DAC_CR_WAVE1_Pos) | DAC_CR_EN1;//sawtooth
+	while((DAC3->SR & DAC_SR_DAC1RDY) == 0)
+		;
+
+	//COMP1: PB1 against DAC3_CH1 (INMSEL = 4), low hysteresis
+	__HAL_RCC_SYSCFG_CLK_ENABLE();
+	COMP1->CSR = (4u << COMP_CSR_INMSEL_Pos) | COMP_CSR_INPSEL | COMP_CSR_HYST_0 | COMP_CSR_EN;
+
+	//EEV4 = COMP1 output, rising edge, bypasses the HRTIM clock
+	eventConfig.Source = HRTIM_EEV4SRC_COMP1_OUT;
+	eventConfig.Polarity = HRTIM_EVENTPOLARITY_HIGH;
+	eventConfig.Sensitivity = HRTIM_EVENTSENSITIVITY_RISINGEDGE;
+	eventConfig.Filter = HRTIM_EVENTFILTER_NONE;
+	eventConfig.FastMode = HRTIM_EVENTFASTMODE_ENABLE;
+	if(HAL_HRTIM_EventConfig(&hhrtim1, HRTIM_EVENT_4, &eventConfig) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	//Timer E: same period as Timer A, no outputs, DAC reset and step triggers
+	timerConfig.InterruptRequests = HRTIM_TIM_IT_NONE;
+	timerConfig.DMARequests = HRTIM_TIM_DMA_NONE;
+	timerConfig.DMASize = 0x1;
+	timerConfig.HalfModeEnable = HRTIM_HALFMODE_DISABLED;
+	timerConfig.InterleavedMode = HRTIM_INTERLEAVED_MODE_DISABLED;
+	timerConfig.StartOnSync = HRTIM_SYNCSTART_DISABLED;
+	timerConfig.ResetOnSync = HRTIM_SYNCRESET_DISABLED;
+	timerConfig.DACSynchro = HRTIM_DACSYNC_NONE;
+	timerConfig.PreloadEnable = HRTIM_PRELOAD_ENABLED;
+	timerConfig.UpdateGating = HRTIM_UPDATEGATING_INDEPENDENT;
+	timerConfig.BurstMode = HRTIM_TIMERBURSTMODE_MAINTAINCLOCK;
+	timerConfig.RepetitionUpdate = HRTIM_UPDATEONREPETITION_DISABLED;
+	timerConfig.ReSyncUpdate = HRTIM_TIMERESYNC_UPDATE_UNCONDITIONAL;
+	timerConfig.PushPull = HRTIM_TIMPUSHPULLMODE_DISABLED;
+	timerConfig.FaultEnable = HRTIM_TIMFAULTENABLE_NONE;
+	timerConfig.FaultLock = HRTIM_TIMFAULTLOCK_READWRITE;
+	timerConfig.DeadTimeInsertion = HRTIM_TIMDEADTIMEINSERTION_DISABLED;
+	timerConfig.DelayedProtectionMode = HRTIM_TIMER_D_E_DELAYEDPROTECTION_DISABLED;
+	timerConfig.UpdateTrigger = HRTIM_TIMUPDATETRIGGER_NONE;
+	timerConfig.ResetTrigger = HRTIM_TIMRESETTRIGGER_MASTER_PER;//in step with Timer A
+	timerConfig.ResetUpdate = HRTIM_TIMUPDATEONRESET_ENABLED;
+
+	timerControl.UpDownMode = HRTIM_TIMERUPDOWNMODE_UP;
+	timerControl.TrigHalf = HRTIM_TIMERTRIGHALF_DISABLED;
+	timerControl.GreaterCMP1 = HRTIM_TIMERGTCMP1_EQUAL;
+	timerControl.DualChannelDacReset = HRTIM_TIMER_DCDR_COUNTER;
+	timerControl.DualChannelDacStep = HRTIM_TIMER_DCDS_CMP2;
+	timerControl.DualChannelDacEnable = HRTIM_TIMER_DCDE_ENABLED;
+
+	if(HAL_HRTIM_TimeBaseConfig(&hhrtim1, HRTIM_TIMERINDEX_TIMER_E, &pGlobalTimeBaseCfg) != HAL_OK
+		|| HAL_HRTIM_WaveformTimerConfig(&hhrtim1, HRTIM_TIMERINDEX_TIMER_E, &timerConfig) != HAL_OK
+		|| HAL_HRTIM_WaveformTimerControl(&hhrtim1, HRTIM_TIMERINDEX_TIMER_E, &timerControl) != HAL_OK)
+	{
+		Error_Handler();
+	}
+	HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_E].PERxR = gPerioid;
+	HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_E].CMP2xR = gPerioid / PCMC_STEPS;
+	HAL_HRTIM_SoftwareUpdate(&hhrtim1, HRTIM_TIMERUPDATE_E);
+	HAL_HRTIM_WaveformCounterStart(&hhrtim1, HRTIM_TIMERID_TIMER_E);
+}
+
+/** ===================================================================
+**     Function Name : void Pcmc_Enable(uint8_t on)
+**     Description : Add or remove external event 4 as reset source of
+**                   TA1/TA2; from Modulation_Set() in open loop only.
+**                   The threshold starts at PCMC_REF_MAX, so until the
+**                   loop runs it is a cycle by cycle current limit.
+**     Parameters  : on - 1 peak current mode, 0 voltage mode
+**     Returns     :
+** ===================================================================*/
+void Pcmc_Enable(uint8_t on)
+{
+	HRTIM_Timerx_TypeDef *ta = &HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A];
+
+	if(on)
+	{
+		DAC3->STR1 = (DAC3->STR1 & ~DAC_STR1_STRSTDATA1_Msk) | ((uint32_t)PCMC_REF_MAX << DAC_STR1_STRSTDATA1_Pos);
+		ta->RSTx1R |= HRTIM_RST1R_EXTVNT4;
+		ta->RSTx2R |= HRTIM_RST2R_EXTVNT4;
+	}
+	else
+	{
+		ta->RSTx1R &= ~HRTIM_RST1R_EXTVNT4;
+		ta->RSTx2R &= ~HRTIM_RST2R_EXTVNT4;
+	}
+}
+
+/** ===================================================================
+**     Function Name : void Pcmc_SetRef(int32_t u)
+**     Description : Peak current threshold from the loop output, and
+**                   the step interval for the present period; control
+**                   ISR with CTR_PCMC
+**     Parameters  : u - loop output, 0..BUCKMaxDuty spans the whole
+**                   threshold range
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Pcmc_SetRef(int32_t u)
+{
+	int32_t ref = PCMC_REF_MIN + u * (PCMC_REF_MAX - PCMC_REF_MIN) / CtrValue.BUCKMaxDuty;
+
+	if(ref > PCMC_REF_MAX)
+		ref = PCMC_REF_MAX;
+	if(ref < PCMC_REF_MIN)
+		ref = PCMC_REF_MIN;
+	DAC3->STR1 = (DAC3->STR1 & ~DAC_STR1_STRSTDATA1_Msk) | ((uint32_t)ref << DAC_STR1_STRSTDATA1_Pos);
+
+	HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_E].PERxR = gPerioid;
+	HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_E].CMP2xR = gPerioid / PCMC_STEPS;
+}
@@ -0,0 +1,213 @@
+/** ===================================================================
+**     File Name   : sample.c
+**     Description : ADC1 configuration for the control and housekeeping
+**                   samples
+**
+**     The two groups of ADC1 are used for different purposes:
+**       Regular  Set point potentiometer, Vin, Iin. Scanned
+**                continuously with 16 x hardware oversampling, DMA
+**                circular into SampReg[]. No CPU time and no interrupt
+**                per conversion.
+**       Injected Vout, Iout, the values the loops regulate. Started by
+**                the HRTIM at a fixed point of every switching period
+**                (Timer A CMP4, SAMP_LEAD_NS before the period end) and
+**                read from JDRx at the start of the next period.
+**     An injected conversion pre-empts the regular scan; the regular
+**     oversampler keeps its partial sum meanwhile (continued mode), so
+**     the housekeeping values are not disturbed by the control samples.
+**     Only the inputs the board has are converted (sample.h); Samp_Read()
+**     gathers them into ADC1_RESULT[] for ADCSample(), the others stay 0.
+**
+**     Replaces MX_ADC1_Init(), which left a single software started
+**     conversion restarted every 10mS by Protect_Task(). The .ioc holds
+**     the same regular set-up for this board (DMA circular, 16 x
+**     oversampling) with the MX_ADC1_Init() call not generated; the
+**     injected group exists only on boards with Vout/Iout (sample.h)
+**     and is configured here.
+** ===================================================================*/
+
+#include "sample.h"
+#include "adc.h"
+#include "hrtim.h"
+
+extern DMA_HandleTypeDef hdma_adc1;
+
+static uint16_t SampReg[SAMP_REG_NUM];//regular scan, DMA circular
+
+static const uint32_t RegCh[SAMP_REG_NUM] =
+{
+	SAMP_CH_VADJ,
+#if SAMP_HAS_VIN
+	SAMP_CH_VIN,
+#endif
+#if SAMP_HAS_IIN
+	SAMP_CH_IIN,
+#endif
+};
+
+#if SAMP_INJ_NUM
+static const uint32_t InjCh[SAMP_INJ_NUM] =
+{
+#if SAMP_HAS_VOUT
+	SAMP_CH_VOUT,
+#endif
+#if SAMP_HAS_IOUT
+	SAMP_CH_IOUT,
+#endif
+};
+#endif
+
+/** ===================================================================
+**     Function Name : void Samp_Init(void)
+**     Description : Configure ADC1 groups and the HRTIM ADC trigger.
+**                   Call after UpdateHRTIM(). The ADC MSP (adc.c)
+**                   sets PA0/PA1 analog; other sense pins are set up
+**                   by the board port.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Samp_Init(void)
+{
+	static const uint32_t RegRank[3] = {ADC_REGULAR_RANK_1, ADC_REGULAR_RANK_2, ADC_REGULAR_RANK_3};
+	ADC_MultiModeTypeDef multimode = {0};
+	ADC_ChannelConfTypeDef reg = {0};
+#if SAMP_INJ_NUM
+	static const uint32_t InjRank[2] = {ADC_INJECTED_RANK_1, ADC_INJECTED_RANK_2};
+	ADC_InjectionConfTypeDef inj = {0};
+	HRTIM_ADCTriggerCfgTypeDef adcTrig = {0};
+#endif
+	uint8_t i;
+
+	hadc1.Instance = ADC1;
+	hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+	hadc1.Init.Resolution = ADC_RESOLUTION_12B;
+	hadc1.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+	hadc1.Init.GainCompensation = 0;
+	hadc1.Init.ScanConvMode = ADC_SCAN_ENABLE;
+	hadc1.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+	hadc1.Init.LowPowerAutoWait = DISABLE;
+	hadc1.Init.ContinuousConvMode = ENABLE;
+	hadc1.Init.NbrOfConversion = SAMP_REG_NUM;
+	hadc1.Init.DiscontinuousConvMode = DISABLE;
+	hadc1.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+	hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	hadc1.Init.DMAContinuousRequests = ENABLE;
+	hadc1.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;//no OVR interrupt, DMA always takes the newest
+	hadc1.Init.OversamplingMode = ENABLE;
+	hadc1.Init.Oversampling.Ratio = SAMP_OVS_RATIO;
+	hadc1.Init.Oversampling.RightBitShift = SAMP_OVS_SHIFT;
+	hadc1.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+	hadc1.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+	if(HAL_ADC_Init(&hadc1) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	multimode.Mode = ADC_MODE_INDEPENDENT;
+	if(HAL_ADCEx_MultiModeConfigChannel(&hadc1, &multimode) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	reg.SamplingTime = ADC_SAMPLETIME_47CYCLES_5;//divider outputs, time is not critical here
+	reg.SingleDiff = ADC_SINGLE_ENDED;
+	reg.OffsetNumber = ADC_OFFSET_NONE;
+	for(i = 0; i < SAMP_REG_NUM; i++)
+	{
+		reg.Channel = RegCh[i];
+		reg.Rank = RegRank[i];
+		if(HAL_ADC_ConfigChannel(&hadc1, &reg) != HAL_OK)
+		{
+			Error_Handler();
+		}
+	}
+
+#if SAMP_INJ_NUM
+	inj.InjectedSamplingTime = ADC_SAMPLETIME_12CYCLES_5;
+	inj.InjectedSingleDiff = ADC_SINGLE_ENDED;
+	inj.InjectedOffsetNumber = ADC_OFFSET_NONE;
+	inj.InjectedNbrOfConversion = SAMP_INJ_NUM;
+	inj.InjectedDiscontinuousConvMode = DISABLE;
+	inj.AutoInjectedConv = DISABLE;
+	inj.QueueInjectedContext = DISABLE;
+	inj.ExternalTrigInjecConv = ADC_EXTERNALTRIGINJEC_HRTIM_TRG2;
+	inj.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONV_EDGE_RISING;
+	inj.InjecOversamplingMode = DISABLE;
+	for(i = 0; i < SAMP_INJ_NUM; i++)
+	{
+		inj.InjectedChannel = InjCh[i];
+		inj.InjectedRank = InjRank[i];
+		if(HAL_ADCEx_InjectedConfigChannel(&hadc1, &inj) != HAL_OK)
+		{
+			Error_Handler();
+		}
+	}
+
+	//Trigger 2 on Timer A CMP4, updated together with Timer A
+	adcTrig.UpdateSource = HRTIM_ADCTRIGGERUPDATE_TIMER_A;
+	adcTrig.Trigger = HRTIM_ADCTRIGGEREVENT24_TIMERA_CMP4;
+	if(HAL_HRTIM_ADCTriggerConfig(&hhrtim1, HRTIM_ADCTRIGGER_2, &adcTrig) != HAL_OK)
+	{
+		Error_Handler();
+	}
+	Samp_Apply(gPerioid);
+#endif
+
+	HAL_ADCEx_Calibration_Start(&hadc1, ADC_SINGLE_ENDED);
+}
+
+/** ===================================================================
+**     Function Name : void Samp_Start(void)
+**     Description : Start the regular scan and arm the injected group
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Samp_Start(void)
+{
+	HAL_ADC_Start_DMA(&hadc1, (uint32_t*)SampReg, SAMP_REG_NUM);
+	__HAL_DMA_DISABLE_IT(&hdma_adc1, DMA_IT_TC | DMA_IT_HT);//nobody waits for the buffer
+#if SAMP_INJ_NUM
+	HAL_ADCEx_InjectedStart(&hadc1);
+#endif
+}
+
+/** ===================================================================
+**     Function Name : void Samp_Read(void)
+**     Description : Copy the fitted inputs into ADC1_RESULT[], CAL_xxx
+**                   order plus the potentiometer at SAMP_VADJ. Called
+**                   from ADCSample(), control ISR.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Samp_Read(void)
+{
+	ADC1_RESULT[SAMP_VADJ] = SampReg[0];
+#if SAMP_HAS_VIN
+	ADC1_RESULT[CAL_VIN] = SampReg[1];
+#endif
+#if SAMP_HAS_IIN
+	ADC1_RESULT[CAL_IIN] = SampReg[SAMP_REG_NUM - 1];
+#endif
+#if SAMP_HAS_VOUT
+	ADC1_RESULT[CAL_VOUT] = (uint16_t)ADC1->JDR1;
+#endif
+#if SAMP_HAS_IOUT
+	ADC1_RESULT[CAL_IOUT] = (uint16_t)(SAMP_HAS_VOUT ? ADC1->JDR2 : ADC1->JDR1);
+#endif
+}
+
+/** ===================================================================
+**     Function Name : void Samp_Apply(int32_t per)
+**     Description : Place the control sample SAMP_LEAD_TICKS before the
+**                   end of the period, mid period if that is too short.
+**                   Called from HRTIM_Apply(), control ISR.
+**     Parameters  : per - HRTIM period, ticks
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Samp_Apply(int32_t per)
+{
+	if(per > 2 * (int32_t)SAMP_LEAD_TICKS)
+		HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].CMP4xR = per - SAMP_LEAD_TICKS;
+	else
+		HRTIM1->sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].CMP4xR = per / 2;
+}
@@ -0,0 +1,243 @@
+/** ===================================================================
+**     File Name   : sched.c
+**     Description : Time-triggered cooperative scheduler
+**
+**     TIM2 interrupts every 100uS (see the time base in function.c).
+**     Sched_Tick() only counts down and releases tasks; the tasks run to
+**     completion in the main loop through Sched_Run(), so the control
+**     ISR is never delayed by them. A release that arrives while the
+**     previous one is still pending is counted as an overrun.
+**
+**     Period/phase are in ticks. Phases are staggered so that no two
+**     slow tasks are released in the same tick.
+**
+**     With nothing released the core sleeps in WFI. Sleep-on-exit is
+**     not used: the tasks run in thread mode, so returning to thread
+**     mode after the tick ISR is exactly what has to happen. The cycles
+**     spent in the control and tick ISRs are counted with the DWT cycle
+**     counter. CYCCNT stops in Sleep (DBGMCU DBG_SLEEP is left off, it
+**     keeps HCLK running while sleeping), so the load window and the idle
+**     time are taken from TIM2, SchedTick plus the counter, which runs in
+**     Sleep; both are turned into CpuLoad.
+** ===================================================================*/
+
+#include "sched.h"
+#include "function.h"
+#include "telemetry.h"
+#include "boot.h"
+#include "mppt.h"
+#include "freqopt.h"
+#include "dtopt.h"
+#include "interleave.h"
+#include "burst.h"
+#include "cal.h"
+#include "params.h"
+#include "evlog.h"
+
+volatile uint32_t SchedTick = 0;//free running tick counter
+volatile uint32_t CtlIsrCyc = 0;
+volatile uint32_t TickIsrCyc = 0;
+volatile uint32_t CtlIsrMax = 0;
+volatile uint32_t CtlIsrOver = 0;
+struct _LOAD CpuLoad = {0, 0, 0, 0, 0, 0};
+
+static uint32_t IdleCyc = 0;//idle cycles in the current window
+
+//CPU cycles per TIM2 count, TIM2 is clocked from HCLK (APB1 not divided)
+#define SCHED_CNT_CYC	(TIM2->PSC + 1)
+
+struct _TASK TaskTab[] =
+{
+	//Func			Period			Phase
+	{Boot_Task,		SCHED_MS(1),	0},//deferred boot steps, idle once done
+	{Button_Task,	SCHED_MS(20),	1},//keys
+	{Event_Task,	SCHED_MS(5),	2},//faults, commands, mode changes
+	{Protect_Task,	SCHED_MS(10),	3},//sampling and protection housekeeping
+	{Mppt_Task,		SCHED_MS(MPPT_PERIOD_MS),	5},//input side MPP tracking
+	{FreqOpt_Task,	SCHED_MS(FOPT_PERIOD_MS),	6},//switching frequency search
+	{DtOpt_Task,	SCHED_MS(DTOPT_PERIOD_MS),	8},//adaptive dead time
+	{Intlv_Task,	SCHED_MS(INTLV_PERIOD_MS),	4},//phase balancing and shedding
+	{Burst_Task,	SCHED_MS(BURST_PERIOD_MS),	9},//light load burst mode
+	{Cal_Task,		SCHED_MS(CAL_PERIOD_MS),	10},//calibration point averaging
+	{Param_Task,	SCHED_MS(PARAM_PERIOD_MS),	SCHED_MS(50) + 13},//parameter store
+	{Log_Task,		SCHED_MS(LOG_PERIOD_MS),	SCHED_MS(50) + 17},//event log
+	{UpdateDutyDisplay,	SCHED_MS(100),	7},//OLED
+	{Tele_Task,		SCHED_MS(TELE_PERIOD_MS),	SCHED_MS(50) + 11},//UART telemetry
+};
+const uint8_t TaskNum = sizeof(TaskTab) / sizeof(TaskTab[0]);
+
+/** ===================================================================
+**     Function Name : void Sched_Init(void)
+**     Description : Load the phase offsets and make sure the DWT cycle
+**                   counter used for execution time accounting runs
+**                   (normally already started by Boot_Start)
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Sched_Init(void)
+{
+	uint8_t i;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	for(i = 0; i < TaskNum; i++)
+	{
+		TaskTab[i].Cnt = TaskTab[i].Phase + 1;
+		TaskTab[i].Release = 0;
+		TaskTab[i].Done = 0;
+	}
+}
+
+/** ===================================================================
+**     Function Name : void Sched_Tick(void)
+**     Description : Release due tasks, TIM2 interrupt context
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Sched_Tick(void)
+{
+	uint8_t i;
+
+	SchedTick++;
+	for(i = 0; i < TaskNum; i++)
+	{
+		if(--TaskTab[i].Cnt == 0)
+		{
+			TaskTab[i].Cnt = TaskTab[i].Period;
+			TaskTab[i].Release++;
+		}
+	}
+}
+
+/** ===================================================================
+**     Function Name : uint32_t Sched_Time(void)
+**     Description : Time in TIM2 counts, runs in Sleep; interrupts off.
+**       An update still pending with the counter already wrapped is a
+**       tick Sched_Tick() has not counted yet.
+**     Parameters  :
+**     Returns     : free running TIM2 count, wraps with SchedTick
+** ===================================================================*/
+static uint32_t Sched_Time(void)
+{
+	uint32_t tick = SchedTick, cnt = TIM2->CNT;
+
+	if((TIM2->SR & TIM_SR_UIF) && cnt < (TIM2->ARR + 1) / 2)
+		tick++;
+	return tick * (TIM2->ARR + 1) + cnt;
+}
+
+/** ===================================================================
+**     Function Name : void Sched_Load(void)
+**     Description : Close the load window every LOAD_WINDOW_MS
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void Sched_Load(void)
+{
+	static uint32_t winStart = 0, ctlStart = 0, tickStart = 0, overStart = 0;
+	uint32_t now, total, ctl, tick, busy, scale;
+
+	__disable_irq();
+	now = Sched_Time();
+	__enable_irq();
+	total = (now - winStart) * SCHED_CNT_CYC;
+	if(total < SystemCoreClock / 1000 * LOAD_WINDOW_MS)
+		return;
+
+	ctl = CtlIsrCyc;
+	tick = TickIsrCyc;
+	scale = total / 1000;//cycles per permille, total*1000 would overflow
+	busy = (total > IdleCyc) ? total - IdleCyc : 0;
+
+	CpuLoad.Cpu = (uint16_t)(busy / scale);
+	CpuLoad.CtlIsr = (uint16_t)((ctl - ctlStart) / scale);
+	CpuLoad.TickIsr = (uint16_t)((tick - tickStart) / scale);
+	CpuLoad.Idle = (uint16_t)(IdleCyc / scale);
+	if(CpuLoad.Cpu > CpuLoad.CtlIsr + CpuLoad.TickIsr)
+		CpuLoad.Task = CpuLoad.Cpu - CpuLoad.CtlIsr - CpuLoad.TickIsr;
+	else
+		CpuLoad.Task = 0;
+
+	//Log the first window over budget only, not every one of a run,
+	//the log is in flash
+	if(CtlIsrOver != overStart && CpuLoad.Over == 0)
+		Log_App(LOG_CTL_OVR, (uint16_t)((CtlIsrMax > 0xFFFF) ? 0xFFFF : CtlIsrMax));
+	CpuLoad.Over = (uint16_t)(CtlIsrOver - overStart);
+
+	winStart = now;
+	ctlStart = ctl;
+	tickStart = tick;
+	overStart = CtlIsrOver;
+	IdleCyc = 0;
+}
+
+/** ===================================================================
+**     Function Name : void Sched_Idle(void)
+**     Description : Sleep until the next interrupt
+**       PRIMASK is set across the pending check and WFI, so a release
+**       in between still wakes the core, and the wake-up is timed
+**       before the pending ISR runs. Timed on TIM2, CYCCNT is halted
+**       while the core sleeps.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+static void Sched_Idle(void)
+{
+	uint32_t start;
+	uint8_t i;
+
+	__disable_irq();
+	for(i = 0; i < TaskNum; i++)
+	{
+		if(TaskTab[i].Release != TaskTab[i].Done)
+			break;
+	}
+	if(i == TaskNum)
+	{
+		start = Sched_Time();
+		__WFI();
+		IdleCyc += (Sched_Time() - start) * SCHED_CNT_CYC;
+	}
+	__enable_irq();
+}
+
+/** ===================================================================
+**     Function Name : void Sched_Run(void)
+**     Description : Run every released task once, in table order,
+**                   then sleep if none was due; main loop context
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Sched_Run(void)
+{
+	struct _TASK *t;
+	uint16_t release, pending;
+	uint32_t start;
+	uint8_t i, ran = 0;
+
+	for(i = 0; i < TaskNum; i++)
+	{
+		t = &TaskTab[i];
+		release = t->Release;
+		pending = (uint16_t)(release - t->Done);
+		if(pending == 0)
+			continue;
+
+		if(pending > 1)
+			t->Overrun += pending - 1;
+		t->Done = release;
+
+		start = DWT->CYCCNT;
+		t->Func();
+		t->ExecLast = DWT->CYCCNT - start;
+		if(t->ExecLast > t->ExecMax)
+			t->ExecMax = t->ExecLast;
+		t->RunCnt++;
+		ran = 1;
+	}
+
+	Sched_Load();
+	if(!ran)
+		Sched_Idle();
+}
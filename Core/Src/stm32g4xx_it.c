@@ -28,6 +28,9 @@
 /* USER CODE BEGIN TD */
 #include "function.h"
 #include "CtlLoop.h"
+#include "telemetry.h"
+#include "sched.h"
+#include "flash.h"
 
 /* USER CODE END TD */
 
@@ -76,7 +79,8 @@ extern UART_HandleTypeDef huart2;
 void NMI_Handler(void)
 {
   /* USER CODE BEGIN NonMaskableInt_IRQn 0 */
-
+	if(Flash_EccNmi())
+		return;//torn double word in the data pages, see flash.c
   /* USER CODE END NonMaskableInt_IRQn 0 */
   /* USER CODE BEGIN NonMaskableInt_IRQn 1 */
    while (1)
@@ -269,8 +273,13 @@ void TIM2_IRQHandler(void)
   /* USER CODE BEGIN TIM2_IRQn 0 */
 	//HAL_GPIO_TogglePin(TEST_LED_GPIO_Port, TEST_LED_Pin);
 
+  uint32_t cyc = DWT->CYCCNT;
+
+  //task releases, 100uS time base
+  Sched_Tick();
+
   //key scan
-  //KEYFlag();
+  Key_Sample();
 
 	//HAL_ADC_Start_DMA(&hadc1, (uint32_t*)ADC1_RESULT, 4); // Start ADC1 sampling, DMA transfer for sampling input/output voltage and current
 	//HAL_ADC_Start(&hadc1); // Start ADC2 sampling, sampling the sliding potentiometer voltage
@@ -287,10 +296,48 @@ void TIM2_IRQHandler(void)
   /* USER CODE END TIM2_IRQn 0 */
   HAL_TIM_IRQHandler(&htim2);
   /* USER CODE BEGIN TIM2_IRQn 1 */
-
+  TickIsrCyc += DWT->CYCCNT - cyc;
   /* USER CODE END TIM2_IRQn 1 */
 }
 
+/**
+  * @brief This function handles HRTIM timer A global interrupt.
+  */
+void HRTIM1_TIMA_IRQHandler(void)
+{
+  /* USER CODE BEGIN HRTIM1_TIMA_IRQn 0 */
+	// Control tick: one repetition event per switching period
+	static uint8_t hk = 0;
+	uint32_t cyc = DWT->CYCCNT;
+
+	__HAL_HRTIM_TIMER_CLEAR_IT(&hhrtim1, HRTIM_TIMERINDEX_TIMER_A, HRTIM_TIM_IT_REP);
+
+	ADCSample();
+	PowerSample();
+	VoutSwOVP();
+	SwOCP();
+	Ctl_Run(); // Mode transfer and closed loop
+
+	// Housekeeping for the main loop at 1/CTL_HK_DIV of the control rate
+	if (++hk >= CTL_HK_DIV)
+	{
+		hk = 0;
+		ADCAverage(); // Averages only the tasks read
+		Tele_Publish(); // Publish a consistent snapshot for the main loop
+	}
+
+	cyc = DWT->CYCCNT - cyc;
+	CtlIsrCyc += cyc;
+	if (cyc > CtlIsrMax)
+		CtlIsrMax = cyc;
+	if (cyc > CTL_ISR_BUDGET)
+		CtlIsrOver++;
+  /* USER CODE END HRTIM1_TIMA_IRQn 0 */
+  /* USER CODE BEGIN HRTIM1_TIMA_IRQn 1 */
+
+  /* USER CODE END HRTIM1_TIMA_IRQn 1 */
+}
+
 /**
   * @brief This function handles USART2 global interrupt / USART2 wake-up interrupt through EXTI line 26.
   */
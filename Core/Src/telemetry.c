@@ -0,0 +1,533 @@
+/** ===================================================================
+**     File Name   : telemetry.c
+**     Description : Consistent snapshot of the sampling/control state
+**
+**     SADC, CtrValue and DF are written by the control ISR every
+**     switching cycle. Readers in the main loop (display, UART telemetry,
+**     command handling) must not read them field by field, otherwise a
+**     Vout from one cycle can be shown next to a duty from another.
+**
+**     The ISR copies the state into TeleSnap once per tick under a
+**     sequence lock:
+**       Seq++ (odd)  -> copy data -> Seq++ (even)
+**     A reader copies the data and retries if Seq was odd or changed
+**     meanwhile. The writer never waits, and no interrupt is disabled.
+** ===================================================================*/
+
+#include "telemetry.h"
+#include "event.h"
+#include "usart.h"
+#include "sched.h"
+#include "boot.h"
+#include "CtlLoop.h"
+#include "mppt.h"
+#include "freqopt.h"
+#include "dtopt.h"
+#include "interleave.h"
+#include "burst.h"
+#include "cal.h"
+#include "params.h"
+#include "evlog.h"
+#include "filter.h"
+#include "sample.h"
+#include "string.h"
+
+struct _SEQ_SNAP TeleSnap = {0};
+volatile uint32_t TeleRetryCnt = 0;//number of retried reads, for diagnostics
+
+static uint8_t TeleBuf[TELE_BUF_SIZE];//UART DMA transmit buffer
+static uint8_t TeleBootPending = 0;//send the boot log instead of the next status frame
+static uint8_t TeleCalPending = 0;//send the calibration table instead of the next status frame
+static uint16_t TeleLogBack = 0;//next event log record to send, back from the newest
+static uint16_t TeleLogLeft = 0;//event log records still to send instead of status frames
+
+/** ===================================================================
+**     Function Name : void Tele_Publish(void)
+**     Description : Publish one snapshot, called every CTL_HK_DIV
+**                   control ticks from the control ISR only (single
+**                   writer)
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+CCMRAM void Tele_Publish(void)
+{
+	TeleSnap.Seq++;//odd: update in progress
+	__DMB();
+
+	TeleSnap.Data.Tick++;
+	TeleSnap.Data.Adc = SADC;
+	TeleSnap.Data.Ctr = CtrValue;
+	TeleSnap.Data.Flag = DF;
+	TeleSnap.Data.Perioid = gPerioid;
+	TeleSnap.Data.Duty = gDuty;
+	TeleSnap.Data.DeadTime = gDeadTime;
+	TeleSnap.Data.Mode = currentMode;
+	TeleSnap.Data.Sat = CtlSat;
+	TeleSnap.Data.Active = CtlActive;
+	TeleSnap.Data.SatCycles = CtlSatCycles;
+	TeleSnap.Data.Pwr = SPWR;
+
+	__DMB();
+	TeleSnap.Seq++;//even: snapshot consistent
+}
+
+/** ===================================================================
+**     Function Name : void Tele_Read(struct _SNAP *dst)
+**     Description : Copy a consistent snapshot; retries if the control
+**                   ISR published while the copy was in progress
+**     Parameters  : dst - destination
+**     Returns     :
+** ===================================================================*/
+void Tele_Read(struct _SNAP *dst)
+{
+	uint32_t seq;
+
+	for(;;)
+	{
+		seq = TeleSnap.Seq;
+		if((seq & 1u) == 0)
+		{
+			__DMB();
+			*dst = TeleSnap.Data;
+			__DMB();
+			if(seq == TeleSnap.Seq)
+				return;
+		}
+		TeleRetryCnt++;
+	}
+}
+
+//Little-endian field writers for the frame payload
+static uint8_t *PutU16(uint8_t *p, uint16_t v)
+{
+	*p++ = (uint8_t)v;
+	*p++ = (uint8_t)(v >> 8);
+	return p;
+}
+
+static uint8_t *PutU32(uint8_t *p, uint32_t v)
+{
+	p = PutU16(p, (uint16_t)v);
+	return PutU16(p, (uint16_t)(v >> 16));
+}
+
+/** ===================================================================
+**     Function Name : void Tele_Send(uint8_t type, uint8_t *end)
+**     Description : Add head, type, length and checksum around the
+**                   payload at TeleBuf[4]..end and start the DMA
+**     Parameters  : type - TELE_TYPE_xxx, end - one past the payload
+**     Returns     :
+** ===================================================================*/
+static void Tele_Send(uint8_t type, uint8_t *end)
+{
+	uint8_t sum = 0;
+	uint8_t len, i;
+
+	len = (uint8_t)(end - &TeleBuf[4]);
+	TeleBuf[0] = TELE_HEAD1;
+	TeleBuf[1] = TELE_HEAD2;
+	TeleBuf[2] = type;
+	TeleBuf[3] = len;
+	for(i = 2; i < len + 4; i++)
+		sum += TeleBuf[i];
+	*end++ = sum;
+
+	HAL_UART_Transmit_DMA(&huart2, TeleBuf, (uint16_t)(end - TeleBuf));
+}
+
+/** ===================================================================
+**     Function Name : void Tele_BootReport(void)
+**     Description : Queue the boot log, sent by the next Tele_Task()
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Tele_BootReport(void)
+{
+	TeleBootPending = 1;
+}
+
+/** ===================================================================
+**     Function Name : void Tele_CalReport(void)
+**     Description : Queue the calibration table and the result of the
+**                   last CMD_CAL, sent by the next Tele_Task()
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Tele_CalReport(void)
+{
+	TeleCalPending = 1;
+}
+
+/** ===================================================================
+**     Function Name : void Tele_LogReport(uint16_t back, uint16_t num)
+**     Description : Queue a range of the event log, sent
+**                   TELE_LOG_RECS records per Tele_Task() pass
+**     Parameters  : back - first record, 0 is the newest
+**                   num - number of records, 0 for all from back on
+**     Returns     :
+** ===================================================================*/
+void Tele_LogReport(uint16_t back, uint16_t num)
+{
+	if(back >= Log.Count)
+		num = 0;
+	else if(num == 0 || num > Log.Count - back)
+		num = Log.Count - back;
+	TeleLogBack = back;
+	TeleLogLeft = num;
+	if(num == 0)
+		TeleLogLeft = 1;//an empty frame still answers the command
+}
+
+/** ===================================================================
+**     Function Name : void Tele_Task(void)
+**     Description : Send one status frame over USART2 (DMA) built from
+**                   a consistent snapshot, or the boot log, the
+**                   calibration table or event log records if pending. Skipped if the previous frame is still
+**                   being transmitted.
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Tele_Task(void)
+{
+	struct _SNAP snap;
+	struct _LOG_REC rec;
+	uint8_t *p, *n;
+	uint8_t i;
+
+	if(huart2.gState != HAL_UART_STATE_READY)
+		return;
+
+	if(TeleBootPending)
+	{
+		TeleBootPending = 0;
+		p = &TeleBuf[4];
+		p = PutU16(p, BootLog.Done);
+		for(i = 0; i < BOOT_PHASE_NUM; i++)
+			p = PutU32(p, BootLog.Us[i]);
+		Tele_Send(TELE_TYPE_BOOT, p);
+		return;
+	}
+
+	if(TeleCalPending)
+	{
+		TeleCalPending = 0;
+		p = &TeleBuf[4];
+		*p++ = CalRun.Result;
+		*p++ = CalRun.Ch;
+		*p++ = CalRun.N;
+		*p++ = CalRun.Stored;
+		for(i = 0; i < CAL_CH_NUM; i++)
+		{
+			p = PutU16(p, (uint16_t)Cal.K[i]);
+			p = PutU16(p, (uint16_t)Cal.B[i]);
+		}
+		Tele_Send(TELE_TYPE_CAL, p);
+		return;
+	}
+
+	if(TeleLogLeft)
+	{
+		p = &TeleBuf[4];
+		p = PutU16(p, Log.Count);
+		p = PutU16(p, TeleLogBack);
+		n = &p[0];
+		*p++ = 0;
+		for(i = 0; i < TELE_LOG_RECS && TeleLogLeft; i++)
+		{
+			TeleLogLeft--;
+			if(Log_Read(TeleLogBack, &rec))
+			{
+				memcpy(p, &rec, sizeof(rec));
+				p += sizeof(rec);
+				(*n)++;
+			}
+			TeleLogBack++;
+		}
+		Tele_Send(TELE_TYPE_LOG, p);
+		return;
+	}
+
+	Tele_Read(&snap);
+
+	p = &TeleBuf[4];
+	p = PutU32(p, snap.Tick);
+	p = PutU16(p, (uint16_t)snap.Adc.VinAvg);
+	p = PutU16(p, (uint16_t)snap.Adc.IinAvg);
+	p = PutU16(p, (uint16_t)snap.Adc.VoutAvg);
+	p = PutU16(p, (uint16_t)snap.Adc.IoutAvg);
+	p = PutU16(p, (uint16_t)snap.Perioid);
+	p = PutU16(p, (uint16_t)snap.Duty);
+	p = PutU16(p, (uint16_t)snap.DeadTime);
+	p = PutU16(p, snap.Flag.ErrFlag);
+	*p++ = snap.Mode;
+	p = PutU32(p, TeleRetryCnt);
+	p = PutU16(p, CpuLoad.Cpu);
+	p = PutU16(p, CpuLoad.CtlIsr);
+	p = PutU16(p, CpuLoad.TickIsr);
+	p = PutU16(p, CpuLoad.Task);
+	p = PutU16(p, IrqPrioErr);
+	*p++ = snap.Sat;
+	*p++ = snap.Active;
+	p = PutU16(p, (uint16_t)snap.Ctr.ILimit);
+	p = PutU32(p, snap.SatCycles);
+	p = PutU16(p, (uint16_t)snap.Ctr.PLimit);
+	p = PutU16(p, (uint16_t)snap.Pwr.Pin);
+	p = PutU16(p, (uint16_t)snap.Pwr.Pout);
+	p = PutU32(p, (uint32_t)(snap.Pwr.EIn / HRTIM_CLK_HZ));//Q12 x s
+	p = PutU32(p, (uint32_t)(snap.Pwr.EOut / HRTIM_CLK_HZ));
+	p = PutU16(p, (uint16_t)snap.Ctr.VinRef);
+	*p++ = Mppt.Alg;
+	*p++ = FreqOpt.Bkt;
+	p = PutU16(p, FreqOpt.Eff);
+	*p++ = DtOpt.Mode;
+	p = PutU16(p, (uint16_t)gDtLeg[0]);
+	p = PutU16(p, (uint16_t)gDtLeg[1]);
+	p = PutU16(p, snap.Flag.CtrFlag);
+	*p++ = Intlv.Active;
+	*p++ = Burst.On;
+	p = PutU16(p, Burst.Duty);//permille of cycles switching
+	p = PutU16(p, (uint16_t)Trans.Events);
+	p = PutU16(p, Filt_Cycles());//filter bank worst case, CPU cycles per sample
+
+	Tele_Send(TELE_TYPE_STATUS, p);
+}
+
+//Receive state machine for command frames
+typedef enum
+{
+	RX_HEAD1,
+	RX_HEAD2,
+	RX_CMD,
+	RX_LEN,
+	RX_DATA,
+	RX_SUM
+}RX_STATE;
+
+static uint8_t TeleRxByte;
+static RX_STATE RxState = RX_HEAD1;
+static struct _CMD_FRAME RxFrame;
+static uint8_t RxCnt, RxSum;
+
+/** ===================================================================
+**     Function Name : void Tele_RxStart(void)
+**     Description : Arm USART2 single-byte interrupt reception
+**     Parameters  :
+**     Returns     :
+** ===================================================================*/
+void Tele_RxStart(void)
+{
+	RxState = RX_HEAD1;
+	HAL_UART_Receive_IT(&huart2, &TeleRxByte, 1);
+}
+
+/** ===================================================================
+**     Function Name : void Tele_RxParse(uint8_t b)
+**     Description : Assemble one command frame byte by byte, USART2
+**                   ISR context. A complete frame with a valid sum is
+**                   pushed to CmdQ for the main loop.
+**     Parameters  : b - received byte
+**     Returns     :
+** ===================================================================*/
+static void Tele_RxParse(uint8_t b)
+{
+	switch(RxState)
+	{
+		case RX_HEAD1:
+			if(b == TELE_HEAD1)
+				RxState = RX_HEAD2;
+			break;
+		case RX_HEAD2:
+			RxState = (b == TELE_HEAD2) ? RX_CMD : RX_HEAD1;
+			break;
+		case RX_CMD:
+			RxFrame.Cmd = b;
+			RxSum = b;
+			RxState = RX_LEN;
+			break;
+		case RX_LEN:
+			if(b > CMD_DATA_MAX)
+			{
+				RxState = RX_HEAD1;
+				break;
+			}
+			RxFrame.Len = b;
+			RxSum += b;
+			RxCnt = 0;
+			RxState = (b == 0) ? RX_SUM : RX_DATA;
+			break;
+		case RX_DATA:
+			RxFrame.Data[RxCnt++] = b;
+			RxSum += b;
+			if(RxCnt >= RxFrame.Len)
+				RxState = RX_SUM;
+			break;
+		case RX_SUM:
+			if(b == RxSum)
+				EvQ_Push(&CmdQ, &RxFrame);
+			RxState = RX_HEAD1;
+			break;
+		default:
+			RxState = RX_HEAD1;
+			break;
+	}
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if(huart->Instance == USART2)
+	{
+		Tele_RxParse(TeleRxByte);
+		HAL_UART_Receive_IT(&huart2, &TeleRxByte, 1);
+	}
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	if(huart->Instance == USART2)
+		Tele_RxStart();
+}
+
+/** ===================================================================
+**     Function Name : void Cmd_Process(const struct _CMD_FRAME *frame)
+**     Description : Execute one command frame, main loop context
+**     Parameters  : frame - command popped from CmdQ
+**     Returns     :
+** ===================================================================*/
+void Cmd_Process(const struct _CMD_FRAME *frame)
+{
+	struct _EVENT ev;
+	int32_t ilimit, plimit, vset;
+	uint8_t i;
+
+	switch(frame->Cmd)
+	{
+		case CMD_GET_STATUS:
+			Tele_Task();
+			break;
+		case CMD_GET_BOOT:
+			Tele_BootReport();
+			Tele_Task();
+			break;
+		case CMD_SET_ILIMIT:
+			if(frame->Len < 2)
+				break;
+			ilimit = frame->Data[0] | (frame->Data[1] << 8);
+			if(ilimit > 2048 && ilimit < IOUT_OCP_VAL)
+				CtrValue.ILimit = ilimit;
+			break;
+		case CMD_SET_PLIMIT:
+			if(frame->Len < 3 || frame->Data[2] > CP_SEL_IN)
+				break;
+			if(frame->Data[2] == CP_SEL_IN && (SAMP_FLAGS_NA & CTR_CP_IN))
+				break;//no input sense to limit on
+			plimit = frame->Data[0] | (frame->Data[1] << 8);
+			if(plimit <= 0 || plimit > 4096)
+				break;
+			CtrValue.PLimit = plimit;
+			if(frame->Data[2] == CP_SEL_OUT)
+				DF.CtrFlag = (DF.CtrFlag & ~CTR_CP_MASK) | CTR_CP_OUT;
+			else if(frame->Data[2] == CP_SEL_IN)
+				DF.CtrFlag = (DF.CtrFlag & ~CTR_CP_MASK) | CTR_CP_IN;
+			else
+				DF.CtrFlag &= ~CTR_CP_MASK;
+			break;
+		case CMD_CLR_ENERGY:
+			PwrClrReq = 1;
+			break;
+		case CMD_SET_MPPT:
+			if(frame->Len < 4 || frame->Data[0] > MPPT_ALG_INC)
+				break;
+			Mppt_Set(frame->Data[0], (int16_t)(frame->Data[1] | (frame->Data[2] << 8)), frame->Data[3]);
+			break;
+		case CMD_SET_FOPT:
+			if(frame->Len < 1 || frame->Data[0] > 2)
+				break;
+			if(frame->Data[0] == 2)
+				FreqOpt_Clear();
+			FreqOpt_Enable(frame->Data[0] != 0);
+			break;
+		case CMD_SET_DT:
+			if(frame->Len < 1 || frame->Data[0] > DT_MODE_ADAPT)
+				break;
+			if(frame->Data[0] == DT_MODE_LEG && frame->Len >= 5)
+				DtOpt_Set(DT_MODE_LEG, frame->Data[1] | (frame->Data[2] << 8), frame->Data[3] | (frame->Data[4] << 8));
+			else
+				DtOpt_Set(frame->Data[0], 0, 0);
+			break;
+		case CMD_SET_MOD:
+			if(frame->Len < 1 || (frame->Data[0] == MOD_PCMC && (SAMP_FLAGS_NA & CTR_PCMC)))
+				break;
+			Modulation_Set(frame->Data[0]);
+			break;
+		case CMD_SET_INTLV:
+			if(frame->Len < 1)
+				break;
+			Intlv_SetShed(frame->Data[0] != 0);
+			break;
+		case CMD_SET_BURST:
+			if(frame->Len < 1)
+				break;
+			Burst_Set(frame->Data[0] != 0, (frame->Len >= 3) ? (int16_t)(frame->Data[1] | (frame->Data[2] << 8)) : 0);
+			break;
+		case CMD_CAL:
+			Cal_Cmd(frame->Data, frame->Len);
+			break;
+		case CMD_PARAM:
+			Param_Cmd(frame->Data, frame->Len);
+			break;
+		case CMD_SET_FILT:
+			if(frame->Len < 3)
+				break;
+			if(frame->Data[0] == 0xFF)
+			{
+				for(i = 0; i < FILT_CH_NUM; i++)
+					Filt_Set(i, frame->Data[1], frame->Data[2]);
+			}
+			else
+				Filt_Set(frame->Data[0], frame->Data[1], frame->Data[2]);
+			break;
+		case CMD_SET_VREF:
+			if(frame->Len < 2)
+				break;
+			vset = frame->Data[0] | (frame->Data[1] << 8);
+			if(vset == 0xFFFF)
+				DF.CtrFlag &= ~CTR_VSET_FIX;
+			else if(vset < 4096)
+			{
+				CtrValue.VSet = vset;//before the flag, the ISR reads it once the flag is set
+				DF.CtrFlag |= CTR_VSET_FIX;
+			}
+			break;
+		case CMD_GET_LOG:
+			if(frame->Len < 4)
+				break;
+			Tele_LogReport(frame->Data[0] | (frame->Data[1] << 8), frame->Data[2] | (frame->Data[3] << 8));
+			break;
+		case CMD_SET_TRANS:
+			if(frame->Len < 1)
+				break;
+			if(frame->Data[0])
+				DF.CtrFlag |= CTR_TRANS;
+			else
+				DF.CtrFlag &= ~CTR_TRANS;
+			break;
+		case CMD_SET_FF:
+			if(frame->Len < 1)
+				break;
+			if(frame->Data[0] && (SAMP_FLAGS_NA & CTR_FF_EN) == 0)
+				DF.CtrFlag |= CTR_FF_EN;
+			else
+				DF.CtrFlag &= ~CTR_FF_EN;
+			break;
+		case CMD_SET_MODE:
+			if(frame->Len < 1 || frame->Data[0] > MODE_CLOSE_LOOP)
+				break;
+			ev.Type = EV_MODE;
+			ev.Arg = frame->Data[0];
+			ev.Val = 0;
+			EvQ_Push(&AppEvQ, &ev);
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Read the fault/event log from the board over USART2 and decode it.
+
+    evlog.py COM5                 dump the whole log, newest first
+    evlog.py COM5 --back 0 -n 20  only the 20 newest records
+    evlog.py --file capture.bin   decode a raw capture of the UART
+
+Frames are described in Core/Inc/telemetry.h, the record layout in
+struct _LOG_REC (Core/Inc/evlog.h). Needs pyserial for the live mode.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+HEAD = b"\xA5\x5A"
+TYPE_LOG = 0x04
+CMD_GET_LOG = 0x20
+
+REC = struct.Struct("<IIHHHHHHHHHHBBH")  # struct _LOG_REC, 32 bytes
+
+CODES = {1: "BOOT", 2: "FAULT", 3: "MODE", 4: "CTL_OVR"}
+FAULTS = {0x01: "VIN_UVP", 0x02: "VIN_OVP", 0x04: "VOUT_UVP", 0x08: "VOUT_OVP", 0x10: "IOUT_OCP", 0x20: "SHORT"}  # F_SW_xxx
+RESET = ["", "OBL", "PIN", "BOR", "SW", "IWDG", "WWDG", "LPWR"]  # RCC_CSR[31:25]
+MODES = {0: "OPEN", 1: "CLOSE"}
+BB = {0: "NA", 1: "BUCK", 2: "BOOST", 3: "MIX"}
+
+
+def command(cmd, data):
+    body = bytes([cmd, len(data)]) + bytes(data)
+    return HEAD + body + bytes([sum(body) & 0xFF])
+
+
+def frames(stream):
+    """Yield (type, payload) for every frame with a good checksum."""
+    buf = b""
+    for chunk in stream:
+        buf += chunk
+        while True:
+            i = buf.find(HEAD)
+            if i < 0:
+                buf = buf[-1:]
+                break
+            buf = buf[i:]
+            if len(buf) < 4 or len(buf) < buf[3] + 5:
+                break
+            n = buf[3]
+            if sum(buf[2:4 + n]) & 0xFF == buf[4 + n]:
+                yield buf[2], buf[4:4 + n]
+                buf = buf[5 + n:]
+            else:
+                buf = buf[2:]
+
+
+def arg_text(code, arg):
+    if code == 1:
+        return "|".join(RESET[b] for b in range(1, 8) if arg & (1 << b)) or "-"
+    if code == 2:
+        return FAULTS.get(arg, "0x%04X" % arg)
+    if code == 3:
+        return MODES.get(arg, str(arg))
+    if code == 4:
+        return "%d cycles" % arg
+    return "0x%04X" % arg
+
+
+def decode(rec):
+    f = REC.unpack(rec)
+    seq, ms, code, arg, err, ctr, vin, iin, vout, iout, duty, per, mode, bb, chk = f
+    ok = zlib.crc32(rec[:30]) & 0xFFFF == chk
+    return ("%6d %10.3f %-5s %-12s err=%04X ctr=%04X vin=%4d iin=%4d vout=%4d iout=%4d "
+            "duty=%5d per=%5d %-5s %-5s%s" % (
+                seq, ms / 1000.0, CODES.get(code, str(code)), arg_text(code, arg), err, ctr,
+                vin, iin, vout, iout, duty, per, MODES.get(mode, str(mode)),
+                BB.get(bb, str(bb)), "" if ok else " BAD"))
+
+
+def dump(stream, want=None):
+    """Print the log records, stop after want records or on timeout."""
+    got = 0
+    for ftype, p in frames(stream):
+        if ftype != TYPE_LOG or len(p) < 5:
+            continue
+        count, back, n = struct.unpack_from("<HHB", p)
+        if got == 0:
+            print("%d records in the log" % count)
+            if want is None:
+                want = max(count - back, 1)
+        for i in range(n):
+            print(decode(p[5 + 32 * i:37 + 32 * i]))
+        got += max(n, 1)
+        if got >= want:
+            break
+
+
+def serial_chunks(port, timeout):
+    last = time.time()
+    while time.time() - last < timeout:
+        data = port.read(256)
+        if data:
+            last = time.time()
+            yield data
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("port", nargs="?", help="serial port of the board")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--back", type=int, default=0, help="first record, 0 is the newest")
+    ap.add_argument("-n", type=int, default=0, help="number of records, 0 for all")
+    ap.add_argument("--file", help="decode a raw UART capture instead")
+    a = ap.parse_args()
+
+    if a.file:
+        with open(a.file, "rb") as f:
+            dump(iter(lambda: f.read(256), b""), a.n or 1 << 16)
+        return
+    if not a.port:
+        ap.error("a serial port or --file is needed")
+
+    import serial
+    with serial.Serial(a.port, a.baud, timeout=0.2) as port:
+        port.reset_input_buffer()
+        port.write(command(CMD_GET_LOG, struct.pack("<HH", a.back, a.n)))
+        dump(serial_chunks(port, 2.0), a.n or None)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
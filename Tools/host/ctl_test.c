@@ -0,0 +1,319 @@
+/*
+ * Voltage loop (CtlLoop.c) closed around an averaged power stage. The
+ * control cycle is run as in Ctl_Run(): sample, BUCKVLoopCtlPID(), and
+ * the duty goes out for the next period, so the one cycle delay of the
+ * target is in the loop. The plant is integrated in SI units and
+ * sampled into the Q12 scales of SADC.
+ */
+#include "host.h"
+#include "CtlLoop.h"
+#include "../../Core/Src/CtlLoop.c"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct _ADI SADC;
+struct _Ctr_value CtrValue;
+struct _FLAG DF;
+struct _POWER SPWR;
+
+//Power stage: 50V and 10A full scale, L 22uH, C 470uF, 10us cycle
+#define V_FS	50.0
+#define I_FS	10.0
+#define PL_L	22e-6
+#define PL_C	470e-6
+#define PL_T	10e-6
+#define PL_SUB	50//integration steps per control cycle
+
+static struct
+{
+	double	Vin;//V
+	double	R;//load, Ohm
+	double	Il;//inductor current, A
+	double	Vc;//output voltage, V
+} Pl;
+
+static int32_t Q(double v, double fs)
+{
+	return (int32_t)lround(v * 4096.0 / fs);
+}
+
+//One switching period at the duties written in the last control cycle
+static void PlantRun(int32_t buck, int32_t boost)
+{
+	double db = buck / 4096.0, dB = boost / 4096.0;
+	double h = PL_T / PL_SUB;
+	int k;
+
+	for(k = 0; k < PL_SUB; k++)
+	{
+		Pl.Il += h * (db * Pl.Vin - (1.0 - dB) * Pl.Vc) / PL_L;
+		Pl.Vc += h * ((1.0 - dB) * Pl.Il - Pl.Vc / Pl.R) / PL_C;
+	}
+}
+
+static void Sample(void)
+{
+	SADC.Vout = Q(Pl.Vc, V_FS);
+	SADC.Iout = 2048 + Q(Pl.Vc / Pl.R, 2 * I_FS);
+	SADC.Vin = Q(Pl.Vin, V_FS);
+}
+
+//Buck mode steady state at vout, loops preloaded with its duty
+static void Start(double vin, double vout, double r, uint16_t flags)
+{
+	memset(&Trans, 0, sizeof(Trans));
+	DF.CtrFlag = flags;
+	DF.BBFlag = Buck;
+	DF.PWMENFlag = 1;
+	CtrValue.BUCKMaxDuty = CLOSE_MAX_DUTY;
+	CtrValue.ILimit = ILIMIT_DEF;
+	CtrValue.Voref = Q(vout, V_FS);
+	Pl.Vin = vin;
+	Pl.R = r;
+	Pl.Vc = vout;
+	Pl.Il = vout / r;
+	Sample();
+	BUCKVLoopInit((int32_t)lround(vout / vin * 4096.0));
+}
+
+//Runs n cycles, returns the largest Vout deviation from Voref, V
+static double Sim(int n)
+{
+	double dev = 0;
+	int16_t buck, boost;
+
+	while(n-- > 0)
+	{
+		buck = CtrValue.BuckDuty;
+		boost = (DF.BBFlag == Buck) ? 0 : CtrValue.BoostDuty;
+		PlantRun(buck, boost);
+		Sample();
+		BUCKVLoopCtlPID();
+		if(fabs(Pl.Vc - CtrValue.Voref * V_FS / 4096.0) > dev)
+			dev = fabs(Pl.Vc - CtrValue.Voref * V_FS / 4096.0);
+	}
+	return dev;
+}
+
+/*
+ * [user-033] Vin feedforward. VinFFInv() has to give back the loop
+ * output that VinFF() turns into the present duty, or the loop start is
+ * not bumpless. Only the buck leg is driven, so in Boost/Mix the loop
+ * has to run without it. Then a 30V -> 36V line step at 12V out:
+ * without feedforward the loop corrects it, with it the duty follows in
+ * the same period.
+ */
+static void TestFeedforward(void)
+{
+	int32_t vin, d, u;
+	double off, on;
+
+	DF.CtrFlag = CTR_FF_EN;
+	DF.BBFlag = Buck;
+	for(vin = VIN_FF_MIN; vin <= 4095; vin += 37)
+	{
+		SADC.Vin = vin;
+		for(d = MIN_BUKC_DUTY; d <= CLOSE_MAX_DUTY; d += 61)
+		{
+			u = VinFFInv(d);
+			if(u < 0 || u > 4096)
+				continue;//not reachable from the loop limits at this Vin
+			VinFF(u);
+			CHECK(abs(CtrValue.BuckDuty - d) <= 1 + VIN_FF_NOM / vin,
+				"vin %d duty %d: VinFF(VinFFInv()) = %d", vin, d, CtrValue.BuckDuty);
+		}
+	}
+
+	DF.BBFlag = Boost;
+	CHECK(!VIN_FF_ON(), "feedforward on in Boost");
+	DF.BBFlag = Mix;
+	CHECK(!VIN_FF_ON(), "feedforward on in Mix");
+	DF.BBFlag = Buck;
+
+	Start(30.0, 12.0, 6.0, 0);
+	Sim(3000);
+	Pl.Vin = 36.0;
+	off = Sim(3000);
+	CHECK(Sim(500) < 0.05, "no feedforward: Vout not settled after the line step");
+
+	Start(30.0, 12.0, 6.0, CTR_FF_EN);
+	Sim(3000);
+	Pl.Vin = 36.0;
+	on = Sim(3000);
+	CHECK(Sim(500) < 0.05, "feedforward: Vout not settled after the line step");
+
+	printf("  line step 30V -> 36V: Vout deviation %.3fV without feedforward, %.3fV with\n", off, on);
+	CHECK(on < off / 4, "feedforward deviation %.3fV, without %.3fV", on, off);
+}
+
+/*
+ * [user-034] Recovery from long saturation. Brown-out: Vin 30V -> 15V
+ * for 200ms holds the duty at BUCKMaxDuty, then Vin comes back. The
+ * same compensator without the clamp on its accumulator (windup, only
+ * the output clamped) runs the same case as the reference; the
+ * overshoot is compared, and Vout has to stay within 0.1V of Voref
+ * after 30ms. Current limit: 1 Ohm for 50ms puts the current loop in
+ * control, the voltage loop has to take over again without overshoot.
+ */
+#define SETTLE_MAX	40000//cycles, 400ms
+
+static int64_t WAcc;//voltage loop state of the windup reference
+static int32_t WErr1, WErr2;
+
+static void WindupRun(void)//one Sim() cycle with the windup reference in place of the loops
+{
+	int32_t e, u;
+
+	PlantRun(CtrValue.BuckDuty, 0);
+	Sample();
+	e = CtrValue.Voref - SADC.Vout;
+	WAcc += (int64_t)e * VLoop.B0 + (int64_t)WErr1 * VLoop.B1 + (int64_t)WErr2 * VLoop.B2;
+	WErr2 = WErr1;
+	WErr1 = e;
+	u = (int32_t)(WAcc >> 8);
+	if(u > CtrValue.BUCKMaxDuty)
+		u = CtrValue.BUCKMaxDuty;
+	if(u < MIN_BUKC_DUTY)
+		u = MIN_BUKC_DUTY;
+	CtrValue.BuckDuty = (int16_t)u;
+}
+
+//Cycles until Vout stays within 0.1V of Voref, SETTLE_MAX if never; *over the largest Vout above it
+static int Settle(uint8_t windup, double *over)
+{
+	double dev;
+	int n, last = 0;
+
+	*over = 0;
+	for(n = 1; n <= SETTLE_MAX; n++)
+	{
+		if(windup)
+			WindupRun();
+		else
+			Sim(1);
+		dev = Pl.Vc - CtrValue.Voref * V_FS / 4096.0;
+		if(dev > *over)
+			*over = dev;
+		if(fabs(dev) > 0.1)
+			last = n;
+	}
+	return last;
+}
+
+static void TestAntiWindup(void)
+{
+	double over, wover;
+	int settle, wsettle, n, imax;
+
+	Start(30.0, 12.0, 6.0, 0);
+	Sim(2000);
+	Pl.Vin = 15.0;
+	Sim(20000);
+	CHECK(VLoop.Acc <= CtrValue.BUCKMaxDuty << 8, "brown-out: accumulator %d past Max", VLoop.Acc);
+	CHECK(CtrValue.BuckDuty >= CtrValue.BUCKMaxDuty - 32, "brown-out: duty %d, not held at Max", CtrValue.BuckDuty);
+	Pl.Vin = 30.0;
+	settle = Settle(0, &over);
+
+	Start(30.0, 12.0, 6.0, 0);
+	WAcc = (int64_t)CtrValue.BuckDuty << 8;
+	WErr1 = WErr2 = 0;
+	for(n = 0; n < 22000; n++)
+	{
+		if(n == 2000)
+			Pl.Vin = 15.0;
+		WindupRun();
+	}
+	Pl.Vin = 30.0;
+	wsettle = Settle(1, &wover);
+
+	printf("  brown-out 200ms: settled in %.1fms, overshoot %.3fV; with windup %.1fms%s, %.3fV\n",
+		settle / 100.0, over, wsettle / 100.0, (wsettle == SETTLE_MAX) ? " (not settled)" : "", wover);
+	CHECK(settle < 3000, "brown-out: settled in %d cycles", settle);
+	CHECK(over < wover / 4, "brown-out: overshoot %.3fV, with windup %.3fV", over, wover);
+
+	Start(30.0, 12.0, 6.0, 0);
+	Sim(2000);
+	Pl.R = 1.0;
+	for(n = 0, imax = 0; n < 5000; n++)
+	{
+		Sim(1);
+		if(n >= 1000 && SADC.Iout > imax)
+			imax = SADC.Iout;
+	}
+	CHECK(imax <= CtrValue.ILimit + 32 && Pl.Vc < 9.0, "current limit: Iout up to %d, ILimit %d, Vout %.2fV",
+		imax, CtrValue.ILimit, Pl.Vc);
+	Pl.R = 6.0;
+	settle = Settle(0, &over);
+	printf("  current limit 50ms: settled in %.1fms, overshoot %.3fV\n", settle / 100.0, over);
+	CHECK(settle < 3000 && over < 0.2, "current limit: settled in %d cycles, overshoot %.3fV", settle, over);
+	CHECK(CtlActive == CTL_LOOP_V && VLoop.Sat == CMP_SAT_NONE, "current limit: voltage loop not back in control");
+}
+
+/*
+ * [user-045] Transient override. Half to full load, 2A -> 4A at 12V,
+ * with and without CTR_TRANS: undershoot and the time until Vout stays
+ * within 0.1V. Then a 50ms overload into the current limit and back,
+ * where the override must not fight the current loop.
+ */
+static double Under(int n, int *settle)//Sim(), largest Vout below Voref
+{
+	double dev, under = 0;
+	int k;
+
+	*settle = 0;
+	for(k = 1; k <= n; k++)
+	{
+		Sim(1);
+		dev = CtrValue.Voref * V_FS / 4096.0 - Pl.Vc;
+		if(dev > under)
+			under = dev;
+		if(fabs(dev) > 0.1)
+			*settle = k;
+	}
+	return under;
+}
+
+static void TestTransient(void)
+{
+	double under[2], over[2];
+	int settle[2], f;
+	uint32_t events;
+
+	for(f = 0; f < 2; f++)
+	{
+		Start(30.0, 12.0, 6.0, f ? CTR_TRANS : 0);
+		Sim(2000);
+		Pl.R = 3.0;
+		under[f] = Under(5000, &settle[f]);
+	}
+	printf("  load step 2A -> 4A: undershoot %.3fV, settled in %.1fms; with CTR_TRANS %.3fV, %.1fms, %u overrides\n",
+		under[0], settle[0] / 100.0, under[1], settle[1] / 100.0, Trans.Events);
+	CHECK(Trans.Events >= 1 && Trans.Events <= 3, "load step: %u overrides", Trans.Events);
+	CHECK(under[1] < under[0] * 0.85, "load step: undershoot %.3fV with CTR_TRANS, %.3fV without", under[1], under[0]);
+	CHECK(settle[1] < settle[0], "load step: settled in %d cycles with CTR_TRANS, %d without", settle[1], settle[0]);
+
+	for(f = 0; f < 2; f++)
+	{
+		Start(30.0, 12.0, 6.0, f ? CTR_TRANS : 0);
+		Sim(2000);
+		Pl.R = 1.5;
+		Sim(5000);
+		Pl.R = 6.0;
+		settle[f] = Settle(0, &over[f]);
+	}
+	events = Trans.Events;
+	printf("  overload 50ms: overshoot %.3fV, settled in %.1fms; with CTR_TRANS %.3fV, %.1fms\n",
+		over[0], settle[0] / 100.0, over[1], settle[1] / 100.0);
+	CHECK(over[1] < over[0] + 0.1 && settle[1] < 3000, "overload: overshoot %.3fV, settled in %d cycles with CTR_TRANS",
+		over[1], settle[1]);
+	CHECK(Trans.State == TRANS_NONE && Sim(1000) < 0.05 && Trans.Events == events, "overload: override still running");
+}
+
+int main(void)
+{
+	TestFeedforward();
+	TestAntiWindup();
+	TestTransient();
+	return HostDone("ctl_test");
+}
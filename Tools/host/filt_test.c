@@ -0,0 +1,151 @@
+/*
+ * Filter bank against a reference model, sample by sample and bit
+ * exact. The reference keeps the whole input history and forms each
+ * output from its definition (floor divided sums, sorted windows), so
+ * it shares no state handling with filter.c. A channel is switched
+ * through every type while running; a switch seeds the history with
+ * the sample it is taken over on (Filt_Seed), the model does the same.
+ */
+#include "host.h"
+#include "filter.h"
+#include "../../Core/Src/filter.c"
+#include <stdlib.h>
+#include <string.h>
+
+#define N_SAMPLES	2400
+
+static int32_t X[N_SAMPLES];
+
+//Reference state of one channel
+static int Type = FILT_IIR1, Shift = 2, Seed = 0;
+static int64_t Acc[2];
+
+static int32_t Hist(int n)//input seen by the filter at sample n
+{
+	return (n < Seed) ? X[Seed] : X[n];
+}
+
+static int CmpInt(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int32_t RefMedian(int n, int len)
+{
+	int32_t w[5];
+	int i;
+
+	for(i = 0; i < len; i++)
+		w[i] = Hist(n - i);
+	qsort(w, len, sizeof(w[0]), CmpInt);
+	return w[len / 2];
+}
+
+static int32_t RefRun(int n)
+{
+	int64_t sum = 0;
+	int i;
+
+	switch(Type)
+	{
+		case FILT_IIR1:
+			Acc[0] += X[n] - FloorShift(Acc[0], Shift);
+			return (int32_t)FloorShift(Acc[0], Shift);
+		case FILT_IIR2:
+			Acc[0] += X[n] - FloorShift(Acc[0], Shift);
+			Acc[1] += FloorShift(Acc[0], Shift) - FloorShift(Acc[1], Shift);
+			return (int32_t)FloorShift(Acc[1], Shift);
+		case FILT_BOX:
+			for(i = 0; i < (1 << Shift); i++)
+				sum += Hist(n - i);
+			return (int32_t)FloorShift(sum, Shift);
+		case FILT_MED3:
+			return RefMedian(n, 3);
+		case FILT_MED5:
+			return RefMedian(n, 5);
+		default:
+			return X[n];
+	}
+}
+
+static void RefSwitch(int n, int type, int shift)
+{
+	Type = type;
+	Shift = (type == FILT_BOX || type == FILT_IIR1 || type == FILT_IIR2) ? shift : 0;
+	Seed = n;
+	Acc[0] = Acc[1] = (int64_t)X[n] << Shift;
+}
+
+//Switch schedule: at sample At the channel goes to Type/Shift
+static const struct { int At, Type, Shift; } Plan[] =
+{
+	{ 300, FILT_IIR2, 3},
+	{ 600, FILT_BOX, 4},
+	{ 900, FILT_MED3, 0},
+	{1000, FILT_MED5, 0},
+	{1200, FILT_IIR1, 6},
+	{1500, FILT_BOX, 1},
+	{1600, FILT_BOX, 4},//same type, new length: seeded again
+	{1800, FILT_NONE, 0},
+	{1900, FILT_IIR2, 1},
+	{2100, FILT_MED5, 0},
+	{2101, FILT_MED3, 0},//back to back switches
+	{2200, FILT_IIR1, 2},
+};
+
+int main(void)
+{
+	uint32_t lcg = 12345;
+	int32_t v[5], w[5], y, r;
+	int n, p = 0, i;
+
+	//Noisy ramp with single and double spikes, negative excursions too
+	for(n = 0; n < N_SAMPLES; n++)
+	{
+		lcg = lcg * 1103515245u + 12345u;
+		X[n] = 2048 + n - (int32_t)((lcg >> 16) % 301) + 150;
+		if(n % 97 == 0)
+			X[n] += 3000;
+		if(n % 131 == 0)
+			X[n + (n + 1 < N_SAMPLES)] = X[n] = -4000;
+	}
+
+	//Median networks against a sort over every 5-tuple of 0..4 (Med3: its
+	//first three)
+	for(n = 0; n < 3125; n++)
+	{
+		for(i = 0, r = n; i < 5; i++, r /= 5)
+			v[i] = w[i] = r % 5;
+		qsort(w, 5, sizeof(w[0]), CmpInt);
+		CHECK(Med5(v) == w[2], "Med5 %d%d%d%d%d", v[0], v[1], v[2], v[3], v[4]);
+		y = Med3(v[0], v[1], v[2]);
+		qsort(v, 3, sizeof(v[0]), CmpInt);
+		CHECK(y == v[1], "Med3 of the first three of %d", n);
+	}
+
+	//Channel 0 from its power-on state: IIR1, Shift 2, zero history
+	for(n = 0; n < N_SAMPLES; n++)
+	{
+		if(p < (int)(sizeof(Plan) / sizeof(Plan[0])) && Plan[p].At == n)
+		{
+			CHECK(Filt_Set(0, Plan[p].Type, Plan[p].Shift), "Filt_Set %d/%d refused", Plan[p].Type, Plan[p].Shift);
+			RefSwitch(n, Plan[p].Type, Plan[p].Shift);
+			p++;
+		}
+		y = Filt_Run(&Filt[0], X[n]);
+		r = RefRun(n);
+		CHECK(y == r, "sample %d type %d shift %d: %d, reference %d", n, Type, Shift, y, r);
+		if(y != r)
+			break;
+	}
+
+	//Settings outside the ranges are refused and leave the request alone
+	CHECK(!Filt_Set(FILT_CH_NUM, FILT_IIR1, 2), "channel range");
+	CHECK(!Filt_Set(0, FILT_MED5 + 1, 0), "type range");
+	CHECK(!Filt_Set(0, FILT_IIR1, 0) && !Filt_Set(0, FILT_IIR2, FILT_SHIFT_MAX + 1), "IIR shift range");
+	CHECK(!Filt_Set(0, FILT_BOX, 0) && !Filt_Set(0, FILT_BOX, FILT_BOX_MAX + 1), "BOX length range");
+	CHECK(Filt[0].Req == FILT_REQ_NONE, "request posted by a refused setting");
+
+	return HostDone("filt_test");
+}
@@ -0,0 +1,34 @@
+/*
+ * Common part of the host tests. A test includes the module source after
+ * this header, so the core peripherals the module touches are host
+ * objects and its static functions are in reach.
+ */
+#ifndef __HOST_H
+#define __HOST_H
+
+#include "main.h"
+#include <stdio.h>
+
+#undef DWT
+static DWT_Type HostDwt __attribute__((unused));
+#define DWT		(&HostDwt)
+
+static int HostFails;
+
+#define CHECK(cond, ...) \
+	do { if(!(cond)) { printf("  FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); HostFails++; } } while(0)
+
+//Floor division by 2^s, what an arithmetic shift does on the target
+static inline int64_t FloorShift(int64_t a, int s)
+{
+	int64_t d = (int64_t)1 << s;
+	return (a >= 0) ? a / d : -((-a + d - 1) / d);
+}
+
+static inline int HostDone(const char *name)
+{
+	printf("%s: %s\n", name, HostFails ? "FAIL" : "ok");
+	return HostFails ? 1 : 0;
+}
+
+#endif
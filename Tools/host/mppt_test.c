@@ -0,0 +1,126 @@
+/*
+ * MPP tracker (mppt.c) on a PV curve. The input voltage loop is taken
+ * as settled within a tracking interval, so the snapshot Mppt_Task
+ * reads is the panel at Vin = VinRef, with one LSB of noise. Built for
+ * a board with the input sense (SAMP_BOARD_DP 0), MPPT is refused
+ * without it.
+ */
+#define SAMP_BOARD_DP	0
+#define SAMP_CH_VIN		0
+#define SAMP_CH_IIN		0
+#define SAMP_CH_VOUT	0
+#define SAMP_CH_IOUT	0
+#include "host.h"
+#include "mppt.h"
+#include "../../Core/Src/mppt.c"
+#include <math.h>
+#include <string.h>
+
+struct _Ctr_value CtrValue;
+struct _FLAG DF;
+volatile uint8_t currentMode = MODE_CLOSE_LOOP;
+
+//Panel: Voc 40V, Isc 8A at full sun, knee 2.5V wide; 50V / 10A full scale
+#define PV_VOC	40.0
+#define PV_ISC	8.0
+#define PV_KNEE	2.5
+#define V_FS	50.0
+#define I_FS	10.0
+
+static double Sun = 1.0;//irradiance, Isc scale
+static double VStart = 39.0;//operating point before MPPT takes over
+static uint32_t Rnd = 1;
+
+static double PvI(double v)
+{
+	double i = Sun * PV_ISC * (1.0 - exp((v - PV_VOC) / PV_KNEE));
+
+	return (i > 0) ? i : 0;
+}
+
+static double PvMpp(void)//largest panel power, W
+{
+	double v, p = 0;
+
+	for(v = 0; v < PV_VOC; v += 0.001)
+		if(v * PvI(v) > p)
+			p = v * PvI(v);
+	return p;
+}
+
+static int32_t Noise(void)//-1, 0, 1
+{
+	Rnd = Rnd * 1103515245u + 12345u;
+	return (int32_t)((Rnd >> 16) % 3) - 1;
+}
+
+static double Vop(void)
+{
+	return (DF.CtrFlag & CTR_MPPT_EN) ? CtrValue.VinRef * V_FS / 4096.0 : VStart;
+}
+
+void Tele_Read(struct _SNAP *dst)
+{
+	double v = Vop();
+
+	memset(dst, 0, sizeof(*dst));
+	dst->Adc.VinAvg = (int32_t)lround(v * 4096.0 / V_FS) + Noise();
+	dst->Adc.IinAvg = 2048 + (int32_t)lround(PvI(v) * 2048.0 / I_FS) + Noise();
+}
+
+/*
+ * [user-037] Convergence from near Voc, then 60s of tracking with the
+ * sun dropping to half at 20s and back at 40s. Convergence is the
+ * first pass at 99% of the MPP; efficiency is the mean panel power over
+ * the MPP from 5s after each change.
+ */
+static void TestTrack(uint8_t alg, const char *name)
+{
+	double pmpp[2], sum = 0, mpp = 0;
+	int n, conv = -1;
+	int32_t vmin = 4096, vmax = 0;
+	uint32_t steps = Mppt.Steps;
+
+	Sun = 0.5;
+	pmpp[1] = PvMpp();
+	Sun = 1.0;
+	pmpp[0] = PvMpp();
+	DF.CtrFlag = 0;
+	Mppt_Set(alg, MPPT_STEP_DEF, MPPT_INTERVAL_DEF);
+	CHECK(DF.CtrFlag & CTR_MPPT_EN, "%s: not enabled", name);
+
+	for(n = 0; n < 6000; n++)//10ms passes
+	{
+		if(n == 2000)
+			Sun = 0.5;
+		else if(n == 4000)
+			Sun = 1.0;
+		Mppt_Task();
+		if(CtrValue.VinRef < vmin)
+			vmin = CtrValue.VinRef;
+		if(CtrValue.VinRef > vmax)
+			vmax = CtrValue.VinRef;
+		if(conv < 0 && Vop() * PvI(Vop()) >= 0.99 * pmpp[0])
+			conv = n;
+		if(n % 2000 >= 500)
+		{
+			sum += Vop() * PvI(Vop());
+			mpp += pmpp[Sun < 1.0];
+		}
+	}
+
+	printf("  %s: converged in %.2fs, efficiency %.2f%%, %u steps\n", name, conv / 100.0, 100.0 * sum / mpp, Mppt.Steps - steps);
+	CHECK(conv >= 0 && conv < 1000, "%s: converged after %d passes", name, conv);
+	CHECK(sum / mpp > 0.99, "%s: efficiency %.4f", name, sum / mpp);
+	CHECK(vmin >= MPPT_VIN_MIN && vmax <= MPPT_VIN_MAX, "%s: VinRef %d..%d out of range", name, vmin, vmax);
+
+	Mppt_Set(MPPT_ALG_OFF, 0, 0);
+	CHECK((DF.CtrFlag & CTR_MPPT_EN) == 0 && Mppt.Alg == MPPT_ALG_OFF, "%s: not switched off", name);
+}
+
+int main(void)
+{
+	TestTrack(MPPT_ALG_PO, "P&O");
+	TestTrack(MPPT_ALG_INC, "IncCond");
+	return HostDone("mppt_test");
+}
@@ -0,0 +1,244 @@
+/*
+ * Peak current mode (pcmc.c) against a model of DAC3 channel 1 in
+ * sawtooth mode and COMP1. DAC3, COMP1, HRTIM1 and the clock enables
+ * are host objects, the HAL calls of Pcmc_Init() record what they are
+ * given. The model reads only the registers pcmc.c wrote: the ramp
+ * starts at STRSTDATA1 on the Timer E reset and steps down by
+ * STINCDATA1 (12.4) on every multiple of Timer E CMP2 within the
+ * period; COMP1 ends the on time when the current sense reaches it.
+ */
+#include "host.h"
+
+static RCC_TypeDef HostRcc;
+static GPIO_TypeDef HostGpiob;
+static DAC_TypeDef HostDac3;
+static COMP_TypeDef HostComp1;
+static HRTIM_TypeDef HostHrtim1;
+#undef RCC
+#undef GPIOB
+#undef DAC3
+#undef COMP1
+#undef HRTIM1
+#define RCC		(&HostRcc)
+#define GPIOB	(&HostGpiob)
+#define DAC3	(&HostDac3)
+#define COMP1	(&HostComp1)
+#define HRTIM1	(&HostHrtim1)
+
+#include "pcmc.h"
+#include "../../Core/Src/pcmc.c"
+
+struct _Ctr_value CtrValue;
+int gPerioid = 16000;
+HRTIM_HandleTypeDef hhrtim1;
+HRTIM_TimeBaseCfgTypeDef pGlobalTimeBaseCfg;
+
+static HRTIM_EventCfgTypeDef Eev4;
+static HRTIM_TimerCtlTypeDef TeCtl;
+static int TeStarted;
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+	(void)GPIOx;
+	(void)GPIO_Init;
+}
+
+HAL_StatusTypeDef HAL_HRTIM_EventConfig(HRTIM_HandleTypeDef *hhrtim, uint32_t Event, const HRTIM_EventCfgTypeDef *pEventCfg)
+{
+	(void)hhrtim;
+	if(Event == HRTIM_EVENT_4)
+		Eev4 = *pEventCfg;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_HRTIM_TimeBaseConfig(HRTIM_HandleTypeDef *hhrtim, uint32_t TimerIdx, const HRTIM_TimeBaseCfgTypeDef *pTimeBaseCfg)
+{
+	(void)hhrtim;
+	HostHrtim1.sTimerxRegs[TimerIdx].PERxR = pTimeBaseCfg->Period;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_HRTIM_WaveformTimerConfig(HRTIM_HandleTypeDef *hhrtim, uint32_t TimerIdx, const HRTIM_TimerCfgTypeDef *pTimerCfg)
+{
+	(void)hhrtim;
+	(void)TimerIdx;
+	(void)pTimerCfg;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_HRTIM_WaveformTimerControl(HRTIM_HandleTypeDef *hhrtim, uint32_t TimerIdx, const HRTIM_TimerCtlTypeDef *pTimerCtl)
+{
+	(void)hhrtim;
+	if(TimerIdx == HRTIM_TIMERINDEX_TIMER_E)
+		TeCtl = *pTimerCtl;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_HRTIM_SoftwareUpdate(HRTIM_HandleTypeDef *hhrtim, uint32_t Timers)
+{
+	(void)hhrtim;
+	(void)Timers;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_HRTIM_WaveformCountStart(HRTIM_HandleTypeDef *hhrtim, uint32_t Timers)
+{
+	(void)hhrtim;
+	TeStarted = (Timers == HRTIM_TIMERID_TIMER_E);
+	return HAL_OK;
+}
+
+void Error_Handler(void)
+{
+	CHECK(0, "Error_Handler() called");
+}
+
+#define TE	(&HostHrtim1.sTimerxRegs[HRTIM_TIMERINDEX_TIMER_E])
+
+static int32_t RampStart(void)
+{
+	return (HostDac3.STR1 & DAC_STR1_STRSTDATA1_Msk) >> DAC_STR1_STRSTDATA1_Pos;
+}
+
+static int32_t RampInc(void)
+{
+	return (HostDac3.STR1 & DAC_STR1_STINCDATA1_Msk) >> DAC_STR1_STINCDATA1_Pos;
+}
+
+//DAC output t ticks after the Timer E reset, for the start value latched there
+static int32_t Ramp(int32_t start, int32_t inc, uint32_t t)
+{
+	int32_t v = (start << 4) - (int32_t)(t / TE->CMP2xR) * inc;
+
+	return (v > 0) ? v >> 4 : 0;
+}
+
+/*
+ * One period of the current sense: up by m1 per period until COMP1
+ * trips on the ramp (EEV4 set as reset source) or the duty backstop,
+ * then down by m2 per period. Returns the sense at the period end.
+ */
+static double Period(double i0, double m1, double m2, double *duty)
+{
+	int32_t start = RampStart(), inc = RampInc();
+	uint32_t per = TE->PERxR, on = per * CtrValue.BUCKMaxDuty >> 12, t;
+	uint8_t cmp = (HostHrtim1.sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].RSTx1R & HRTIM_RST1R_EXTVNT4) != 0;
+
+	for(t = 0; cmp && t < on; t++)
+		if(i0 + m1 * t / per >= Ramp(start, inc, t))
+			on = t;
+	*duty = (double)on / per;
+	return i0 + m1 * on / per - m2 * (per - on) / per;
+}
+
+/*
+ * [user-044] Register set up, the loop output to threshold map over
+ * the period range, and the slope compensation: at D = 0.6 a
+ * perturbation of the current has to die out with the ramp, down to
+ * the one ramp step the staircase leaves, and grow into period
+ * doubling without it.
+ */
+static void TestSetup(void)
+{
+	HostDac3.SR = DAC_SR_DAC1RDY;
+	pGlobalTimeBaseCfg.Period = gPerioid;
+	Pcmc_Init();
+
+	CHECK(RampStart() == PCMC_REF_MIN && RampInc() == PCMC_SLOPE * 16 / PCMC_STEPS && (HostDac3.STR1 & DAC_STR1_STDIR1) == 0,
+		"DAC3 STR1 0x%08X", (unsigned)HostDac3.STR1);
+	CHECK((HostDac3.CR & DAC_CR_WAVE1) == (3u << DAC_CR_WAVE1_Pos) && (HostDac3.CR & DAC_CR_EN1), "DAC3 CR 0x%08X", (unsigned)HostDac3.CR);
+	CHECK(((HostComp1.CSR & COMP_CSR_INMSEL) >> COMP_CSR_INMSEL_Pos) == 4 && (HostComp1.CSR & COMP_CSR_EN),
+		"COMP1 CSR 0x%08X", (unsigned)HostComp1.CSR);
+	CHECK(Eev4.Source == HRTIM_EEV4SRC_COMP1_OUT && Eev4.FastMode == HRTIM_EVENTFASTMODE_ENABLE, "EEV4 not fast from COMP1");
+	CHECK(TeCtl.DualChannelDacReset == HRTIM_TIMER_DCDR_COUNTER && TeCtl.DualChannelDacStep == HRTIM_TIMER_DCDS_CMP2
+		&& TeCtl.DualChannelDacEnable == HRTIM_TIMER_DCDE_ENABLED && TeStarted, "Timer E DAC triggers");
+	CHECK(TE->PERxR == (uint32_t)gPerioid && TE->CMP2xR == (uint32_t)gPerioid / PCMC_STEPS, "Timer E PER %u CMP2 %u",
+		(unsigned)TE->PERxR, (unsigned)TE->CMP2xR);
+
+	Pcmc_Enable(1);
+	CHECK(RampStart() == PCMC_REF_MAX && (HostHrtim1.sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].RSTx1R & HRTIM_RST1R_EXTVNT4)
+		&& (HostHrtim1.sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].RSTx2R & HRTIM_RST2R_EXTVNT4), "Pcmc_Enable(1)");
+	Pcmc_Enable(0);
+	CHECK((HostHrtim1.sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].RSTx1R & HRTIM_RST1R_EXTVNT4) == 0
+		&& (HostHrtim1.sTimerxRegs[HRTIM_TIMERINDEX_TIMER_A].RSTx2R & HRTIM_RST2R_EXTVNT4) == 0, "Pcmc_Enable(0)");
+}
+
+static void TestSetRef(void)
+{
+	static const int16_t MaxDuty[] = {CLOSE_MAX_DUTY, PSFB_MAX_DUTY};
+	int32_t u, last, drop;
+	unsigned m;
+
+	for(m = 0; m < 2; m++)
+	{
+		CtrValue.BUCKMaxDuty = MaxDuty[m];
+		last = 0;
+		for(u = -100; u <= CtrValue.BUCKMaxDuty + 100; u++)
+		{
+			Pcmc_SetRef(u);
+			CHECK(RampStart() >= last && RampStart() >= PCMC_REF_MIN && RampStart() <= PCMC_REF_MAX,
+				"max duty %d: u %d gives %d after %d", CtrValue.BUCKMaxDuty, u, RampStart(), last);
+			CHECK(RampInc() == PCMC_SLOPE * 16 / PCMC_STEPS, "u %d: step changed to %d", u, RampInc());
+			last = RampStart();
+			if(u == 0)
+				CHECK(RampStart() == PCMC_REF_MIN, "u 0 gives %d", RampStart());
+			if(u == CtrValue.BUCKMaxDuty)
+				CHECK(RampStart() == PCMC_REF_MAX, "u %d gives %d", u, RampStart());
+		}
+	}
+
+	for(gPerioid = FreqMin; gPerioid <= FreqMax; gPerioid += 16)
+	{
+		Pcmc_SetRef(CtrValue.BUCKMaxDuty / 2);
+		drop = RampStart() - Ramp(RampStart(), RampInc(), gPerioid - 1);
+		CHECK(TE->PERxR == (uint32_t)gPerioid && drop >= PCMC_SLOPE - RampInc() / 16 - 1 && drop <= PCMC_SLOPE,
+			"period %d: ramp drops by %d", gPerioid, drop);
+	}
+	gPerioid = 16000;
+}
+
+//Peak to peak of the period end current over the last periods
+static double Ripple(uint8_t slope, double *duty)
+{
+	double i = PCMC_REF_MIN + 400, lo = 1e9, hi = -1e9;
+	int n;
+
+	CtrValue.BUCKMaxDuty = PSFB_MAX_DUTY;
+	Pcmc_Enable(1);
+	Pcmc_SetRef(CtrValue.BUCKMaxDuty * 3 / 4);
+	if(!slope)
+		HostDac3.STR1 &= ~DAC_STR1_STINCDATA1_Msk;
+	for(n = 0; n < 400; n++)
+	{
+		i = Period(i, 256, 384, duty);//sense slopes for D = 0.6, counts per period
+		if(n == 100)
+			i += 40;//perturbation
+		if(n >= 300)
+		{
+			lo = (i < lo) ? i : lo;
+			hi = (i > hi) ? i : hi;
+		}
+	}
+	Pcmc_Enable(0);
+	return hi - lo;
+}
+
+static void TestSlope(void)
+{
+	double with, without, d1, d0;
+
+	with = Ripple(1, &d1);
+	without = Ripple(0, &d0);
+	printf("  D 0.6, sense slopes 256/384 per period: period end current swings %.1f with the ramp, %.1f without\n",
+		with, without);
+	CHECK(with <= PCMC_SLOPE / PCMC_STEPS && d1 > 0.58 && d1 < 0.62, "with the ramp: swing %.1f, duty %.3f", with, d1);
+	CHECK(without > 50, "without the ramp: swing %.1f, no period doubling", without);
+}
+
+int main(void)
+{
+	TestSetup();
+	TestSetRef();
+	TestSlope();
+	return HostDone("pcmc_test");
+}
@@ -0,0 +1,53 @@
+/*
+ * Host stand-in for CMSIS cmsis_compiler.h, forced in by the Tools/host
+ * build before anything else; it has the same include guard, so the
+ * CMSIS one is skipped. core_cm4.h and the HAL
+ * headers see the usual GCC attribute macros; the core intrinsics the
+ * firmware uses map to host builtins, so the sources under test compile
+ * unchanged for the build machine.
+ */
+#ifndef __CMSIS_COMPILER_H
+#define __CMSIS_COMPILER_H
+
+#include <stdint.h>
+
+#define __ASM				__asm
+#define __INLINE			inline
+#define __STATIC_INLINE		static inline
+#define __STATIC_FORCEINLINE	__attribute__((always_inline)) static inline
+#define __NO_RETURN			__attribute__((__noreturn__))
+#define __USED				__attribute__((used))
+#define __WEAK				__attribute__((weak))
+#define __PACKED			__attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT		struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION		union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)		__attribute__((aligned(x)))
+#define __RESTRICT			__restrict
+#define __COMPILER_BARRIER()	__ASM volatile("":::"memory")
+
+//Barriers: full host fences, the queues are tested across threads
+#define __DMB()		__sync_synchronize()
+#define __DSB()		__sync_synchronize()
+#define __ISB()		__sync_synchronize()
+#define __NOP()		((void)0)
+#define __WFI()		((void)0)
+#define __WFE()		((void)0)
+#define __SEV()		((void)0)
+
+__STATIC_INLINE void __disable_irq(void) {}
+__STATIC_INLINE void __enable_irq(void) {}
+__STATIC_INLINE uint32_t __get_PRIMASK(void) { return 0; }
+__STATIC_INLINE void __set_PRIMASK(uint32_t pri) { (void)pri; }
+
+//Exclusive access: the host has a single "core" per test, the store
+//always succeeds
+__STATIC_INLINE uint16_t __LDREXH(volatile uint16_t *addr) { return *addr; }
+__STATIC_INLINE uint32_t __STREXH(uint16_t value, volatile uint16_t *addr) { *addr = value; return 0; }
+__STATIC_INLINE uint32_t __LDREXW(volatile uint32_t *addr) { return *addr; }
+__STATIC_INLINE uint32_t __STREXW(uint32_t value, volatile uint32_t *addr) { *addr = value; return 0; }
+__STATIC_INLINE void __CLREX(void) {}
+
+#define __CLZ(x)	((uint8_t)((x) ? __builtin_clz(x) : 32))
+#define __REV(x)	__builtin_bswap32(x)
+
+#endif